@@ -8,9 +8,31 @@
 
 #include "Mifare.h"
 
-static byte packetbuffer[PN532_PACKBUFFSIZE] ;
-static uint8_t uid[] = { 0, 0, 0, 0, 0, 0, 0 };
-static uint8_t uidLength ;
+static byte packetbuffer[MIFARE_PACKBUFFSIZE] ;
+static MIFARE_SESSION sessions[MIFARE_MAX_TARGETS] ;
+static uint8_t targetCount ;
+static MIFARE_SESSION * session ;  // active session, 0 until a target is detected
+static MIFARE_TARGET * target ;    // target of the active session
+static uint16_t dataSize ;    // size in bytes of the NDEF data area of the current card
+static uint8_t listedSize ;   // bytes of the last InListPassiveTarget response read
+static const MIFARE_KEY * keyDictionary ;
+static uint8_t keyDictionarySize ;
+static MIFARE_KEYHIT keyHits[MIFARE_KEYHITS] ;    // key that worked per card and sector
+static uint8_t keyHitNext ;
+static uint8_t writeMode = MIFARE_WRITE_FULL ;
+static uint8_t retries = MIFARE_RETRIES ;
+static boolean verifyWrites = false ;
+static MIFARE_VERIFY verifyReport ;
+static MIFARE_TARGET * authTarget ;    // classic sector authenticated by classic_authenticateBlock
+static uint8_t authSector = 0xFF ;
+
+/*
+ the card drops its authentication on any error, and on select and release
+ */
+static void forgetAuthentication (){
+    authTarget = 0;
+    authSector = 0xFF;
+}
 
 Mifare::Mifare(){}
 
@@ -38,25 +60,174 @@ boolean Mifare::SAMConfig() {
 
 /**************************************************************************/
 /*!
- Waits for an ISO14443A target to enter the field
-  
- @returns a pointer to the uid array or 0 if it fails
+ Sets how many times InListPassiveTarget tries to activate a target
+ before it answers with no target found (RFConfiguration MaxRetries).
+ The default 0xFF retries forever, a small number makes readTarget and
+ detect return quickly when the field is empty.
  */
 /**************************************************************************/
-uint8_t* Mifare::readTarget(uint16_t timeout) {
+boolean Mifare::setPassiveActivationRetries(uint8_t retries) {
+    packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
+    packetbuffer[1] = 0x05;     // CfgItem MaxRetries
+    packetbuffer[2] = 0xFF;     // MxRtyATR, default
+    packetbuffer[3] = 0x01;     // MxRtyPSL, default
+    packetbuffer[4] = retries;  // MxRtyPassiveActivation
+    
+    if (! board->sendCommandCheckAck(packetbuffer, 5))
+        return false;
+    
+    board->readdata(packetbuffer, 8);
+    return (packetbuffer[6] == PN532_COMMAND_RFCONFIGURATION + 1);
+}
+
+
+/**************************************************************************/
+/*!
+ Reads PN532 registers, as many per ReadRegister frame as fit in
+ packetbuffer (MIFARE_REGISTERS_READ) and the transport's frames, so a
+ tuning profile is checked in one round trip (two over I2C on AVR)
+ 
+ @param  registers  addresses set by the caller, values are filled in
+ @param  count      number of registers
+ 
+ @returns false if a frame fails
+ */
+/**************************************************************************/
+boolean Mifare::readRegisters(MIFARE_REGISTER * registers, uint8_t count) {
+    uint8_t batch = MIFARE_REGISTERS_READ;
+    
+    // command code and 2 address bytes each, the values come back in a frame of 9 + n bytes
+    if (batch > (board->commandlimit() - 1) / 2)
+        batch = (board->commandlimit() - 1) / 2;
+    if (batch > frameSize() - 9)
+        batch = frameSize() - 9;
+    
+    while (count > 0) {
+        uint8_t n = (count < batch) ? count : batch;
+        
+        packetbuffer[0] = PN532_COMMAND_READREGISTER;
+        for (uint8_t i = 0; i < n; i++) {
+            packetbuffer[1 + 2 * i] = registers[i].address >> 8;
+            packetbuffer[2 + 2 * i] = registers[i].address;
+        }
+        
+        if (! board->sendCommandCheckAck(packetbuffer, 1 + 2 * n))
+            return false;
+        
+        // the values follow the command code, there is no status byte
+        board->readdata(packetbuffer, 7 + n + 2);
+        if (packetbuffer[6] != PN532_COMMAND_READREGISTER + 1 || packetbuffer[3] != 2 + n)
+            return false;
+        
+        for (uint8_t i = 0; i < n; i++)
+            registers[i].value = packetbuffer[7 + i];
+        registers += n;
+        count -= n;
+    }
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Writes PN532 registers, as many per WriteRegister frame as fit in
+ packetbuffer (MIFARE_REGISTERS_WRITE) and the transport's commands (7
+ over I2C on AVR). A tuning profile of up to that many registers is
+ applied in one round trip, at startup or between polls.
+ 
+ @param  registers  addresses and values
+ @param  count      number of registers
+ 
+ @returns false if a frame fails
+ */
+/**************************************************************************/
+boolean Mifare::writeRegisters(const MIFARE_REGISTER * registers, uint8_t count) {
+    uint8_t batch = MIFARE_REGISTERS_WRITE;
+    
+    // command code and 3 bytes each: address and value
+    if (batch > (board->commandlimit() - 1) / 3)
+        batch = (board->commandlimit() - 1) / 3;
+    
+    while (count > 0) {
+        uint8_t n = (count < batch) ? count : batch;
+        
+        packetbuffer[0] = PN532_COMMAND_WRITEREGISTER;
+        for (uint8_t i = 0; i < n; i++) {
+            packetbuffer[1 + 3 * i] = registers[i].address >> 8;
+            packetbuffer[2 + 3 * i] = registers[i].address;
+            packetbuffer[3 + 3 * i] = registers[i].value;
+        }
+        
+        if (! board->sendCommandCheckAck(packetbuffer, 1 + 3 * n))
+            return false;
+        
+        board->readdata(packetbuffer, 8);
+        if (packetbuffer[6] != PN532_COMMAND_WRITEREGISTER + 1)
+            return false;
+        
+        registers += n;
+        count -= n;
+    }
+    return true;
+}
+
+
+/*
+ switches the RF field off or on, tags lose their state when it is off
+ */
+boolean Mifare::setField(boolean on) {
+    packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
+    packetbuffer[1] = 0x01;     // CfgItem RF field
+    packetbuffer[2] = on ? 0x01 : 0x00;
+    
+    if (! board->sendCommandCheckAck(packetbuffer, 3))
+        return false;
+    
+    board->readdata(packetbuffer, 8);
+    return (packetbuffer[6] == PN532_COMMAND_RFCONFIGURATION + 1);
+}
+
+
+/**************************************************************************/
+/*!
+ Sends InListPassiveTarget and waits for the targets to enter the field.
+ Every session ends, the response is left in packetbuffer. When readSize
+ doesn't fit in a response frame (frameSize) only one target is listed,
+ so its record isn't cut short.
+ 
+ @param  baudRate       MIFARE_ISO14443A, MIFARE_FELICA_212 or MIFARE_FELICA_424
+ @param  initiatorData  sent after the baud rate, 0 for none
+ @param  length         its length
+ @param  timeout        ms to wait, 0 waits forever
+ @param  readSize       bytes of the response to read
+ 
+ @returns false if the command fails or times out
+ */
+/**************************************************************************/
+boolean Mifare::listTargets(uint8_t baudRate, const uint8_t * initiatorData, uint8_t length, uint16_t timeout, uint8_t readSize) {
 
+    forgetAuthentication();
+    session = 0;
+    target = 0;
+    targetCount = 0;
+    for (uint8_t n = 0; n < MIFARE_MAX_TARGETS; n++)
+        sessions[n].state = MIFARE_SESSION_IDLE;
+    
+    listedSize = (readSize < frameSize()) ? readSize : frameSize();
+    
     packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
-    packetbuffer[1] = 1;  // max 1 cards at once (we can set this to 2 later)
-    packetbuffer[2] = MIFARE_ISO14443A; //card baud rate?
+    packetbuffer[1] = (listedSize == readSize) ? MIFARE_MAX_TARGETS : 1;  // max cards at once (the PN532 handles 2)
+    packetbuffer[2] = baudRate;
+    if (length)
+        memcpy(packetbuffer + 3, initiatorData, length);
     
-    if (! board->sendCommandCheckAck(packetbuffer, 3)){
+    if (! board->sendCommandCheckAck(packetbuffer, 3 + length)){
 #ifdef MIFAREDEBUG
         Serial.println("No card(s) read");
 #endif
-        return 0x0;
+        return false;
     }
     
-    uint8_t status = PN532_BUSY;
 #ifdef MIFAREDEBUG
     Serial.println("Waiting for card");
 #endif
@@ -67,7 +238,7 @@ uint8_t* Mifare::readTarget(uint16_t timeout) {
         if (timeout != 0) {
           timer+=10;
           if (timer > timeout){
-             return 0;
+             return false;
           }
         }
         delay(10);
@@ -77,9 +248,39 @@ uint8_t* Mifare::readTarget(uint16_t timeout) {
     Serial.println("Found a card");
 #endif
     
-    // read data packet
-    board->readdata(packetbuffer, 20);
+    board->readdata(packetbuffer, listedSize);
+    return (packetbuffer[6] == PN532_COMMAND_INLISTPASSIVETARGET + 1);
+}
+
+
+/**************************************************************************/
+/*!
+ Waits for ISO14443A targets to enter the field, up to MIFARE_MAX_TARGETS
+ are detected by the same command. The first one becomes the active target.
+  
+ @returns a pointer to the uid array of the first target or 0 if it fails
+ */
+/**************************************************************************/
+uint8_t* Mifare::readTarget(uint16_t timeout) {
+
+    // read data packet, enough for every target with a 7 byte UID
+    if (!listTargets(MIFARE_ISO14443A, 0, 0, timeout, MIFARE_TARGETS_READSIZE))
+        return 0;
+    if (readTargetRecords() == 0)
+        return 0;
     
+    if (!useTarget(1))
+        return 0;
+    
+    return target->uid;
+}
+
+
+/*
+ reads the ISO14443A target records of an InListPassiveTarget response
+ into the sessions, returns the number of targets
+ */
+uint8_t Mifare::readTargetRecords(void) {
     // check some basic stuff
     /* ISO14443A card response should be in the following format:
      
@@ -87,304 +288,2536 @@ uint8_t* Mifare::readTarget(uint16_t timeout) {
      -------------   ------------------------------------------
      b0..6           Frame header and preamble
      b7              Tags Found
-     b8              Tag Number (only one used in this example)
-     b9..10          SENS_RES
-     b11             SEL_RES
-     b12             NFCID Length
-     b13..NFCIDLen   NFCID                                      */
+     
+     then for every tag:
+     b0              Tag Number
+     b1..2           SENS_RES
+     b3              SEL_RES
+     b4              NFCID Length
+     b5..NFCIDLen    NFCID
+     ATS             only when SEL_RES flags ISO14443-4, first byte is its length */
     
 #ifdef MIFAREDEBUG
     Serial.print("Found "); Serial.print(packetbuffer[7], DEC); Serial.println(" tags");
 #endif
-    if (packetbuffer[7] != 1)
+    uint8_t found = packetbuffer[7];
+    if (found == 0 || found > MIFARE_MAX_TARGETS)
         return 0;
     
-    uint16_t sens_res = packetbuffer[9];
-    sens_res <<= 8;
-    sens_res |= packetbuffer[10];
-#ifdef MIFAREDEBUG
-    Serial.print("Sens Response: 0x");  Serial.println(sens_res, HEX);
-    Serial.print("Sel Response: 0x");  Serial.println(packetbuffer[11], HEX);
-#endif
+    // frame length counts from the TFI byte (b5), anything past it wasn't read
+    uint8_t end = 5 + packetbuffer[3];
+    if (end > listedSize)
+        end = listedSize;
+    uint8_t position = 8;
     
-    uidLength = packetbuffer[12];
-
-    for (uint8_t i=0; i< uidLength; i++) {
-       uid[i] = packetbuffer[13+i];
+    for (uint8_t n = 0; n < found; n++) {
+        MIFARE_TARGET * t = &sessions[n].target;
+        
+        // a record cut short by the read size is dropped
+        if (position + 5 > end || position + 5 + packetbuffer[position + 4] > end)
+            break;
+        if (packetbuffer[position + 4] > sizeof(t->uid))
+            break;
+        
+        t->tg = packetbuffer[position];
+        t->atqa = (packetbuffer[position + 1] << 8) | packetbuffer[position + 2];
+        t->sak = packetbuffer[position + 3];
+        t->type = ((uint32_t)t->atqa << 8) | t->sak;
+        t->uidLength = packetbuffer[position + 4];
+        memcpy(t->uid, packetbuffer + position + 5, t->uidLength);
+        position += 5 + t->uidLength;
+        
+        if (t->sak & 0x20)
+            position += packetbuffer[position];
+        
 #ifdef MIFAREDEBUG
-        Serial.print(" 0x");Serial.print(uid[i], HEX);
+        Serial.print("Tg: "); Serial.println(t->tg, DEC);
+        Serial.print("Sens Response: 0x");  Serial.println(t->atqa, HEX);
+        Serial.print("Sel Response: 0x");  Serial.println(t->sak, HEX);
+        for (uint8_t i=0; i< t->uidLength; i++) {
+            Serial.print(" 0x");Serial.print(t->uid[i], HEX);
+        }
+        Serial.println("");
 #endif
+        sessions[n].state = MIFARE_SESSION_SELECTED;
+        sessions[n].mapped = false;
+        sessions[n].formatted = false;
+        targetCount++;
     }
     
-    cardType = packetbuffer[9] << 16;
-    cardType += packetbuffer[10] << 8;
-    cardType += packetbuffer[11];
-    
-#ifdef MIFAREDEBUG
-    Serial.print("UID:");
-    for(uint8_t i=0;i<20;i++){
-        Serial.print(packetbuffer[i], HEX); Serial.print(" ");
-    }
-    Serial.println("");
-#endif
-    
-    return uid;
+    return targetCount;
 }
 
 
-boolean Mifare::classic_formatForNDEF (){
-    uint8_t sectorbuffer1[16] = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
-    uint8_t sectorbuffer2[16] = {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
-    uint8_t sectorbuffer3[16] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    
-    // Write block 1 and 2 to the card
-    if (!(classic_writeMemoryBlock (1, sectorbuffer1)))
-        return false;
-    if (!(classic_writeMemoryBlock (2, sectorbuffer2)))
-        return false;
-    // Write key A and access rights card
-    if (!(classic_writeMemoryBlock (3, sectorbuffer3)))
+/**************************************************************************/
+/*!
+ Makes one of the targets found by readTarget the active target, the
+ following card operations address it
+ 
+ @param  number   1 for the first target, 2 for the second
+ 
+ @returns false if there is no such target
+ */
+/**************************************************************************/
+boolean Mifare::useTarget(uint8_t number) {
+    if (number == 0 || number > targetCount)
         return false;
-//    Serial.println("FORMATTED");
     
-    // Seems that everything was OK (?!)
+    session = &sessions[number - 1];
+    target = &session->target;
+    cardType = target->type;
     return true;
 }
 
 
-/* read payload */
+/**************************************************************************/
+/*!
+ @returns the number of targets found by the last readTarget
+ */
+/**************************************************************************/
+uint8_t Mifare::getTargetCount() {
+    return targetCount;
+}
 
-//get type of card and size, then either classic or ultralight read all the blocks
-//output is a char array buffer to write output into
 
-boolean Mifare::readPayload (uint8_t * output, uint8_t lengthLimit){
-    if (!readTarget())
-        return false;
+/**************************************************************************/
+/*!
+ @param  number   1 for the first target, 2 for the second
+ 
+ @returns the UID/ATQA/SAK record of a target found by readTarget, or 0
+ */
+/**************************************************************************/
+MIFARE_TARGET * Mifare::getTarget(uint8_t number) {
+    if (number == 0 || number > targetCount)
+        return 0;
+    
+    return &sessions[number - 1].target;
+}
+
+
+/**************************************************************************/
+/*!
+ Waits for FeliCa targets to enter the field, like readTarget. The PN532
+ polls with the given system code, FELICA_SYSTEM_NDEF finds type 3 tags
+ only. The IDm of a target is kept as its uid, its type is MIFARE_FELICA.
+ 
+ @param  baudRate     MIFARE_FELICA_212 or MIFARE_FELICA_424
+ @param  systemCode   FELICA_SYSTEM_NDEF, FELICA_SYSTEM_ANY or another system
+ 
+ @returns a pointer to the IDm of the first target or 0 if it fails
+ */
+/**************************************************************************/
+uint8_t* Mifare::readFeliCaTarget(uint8_t baudRate, uint16_t systemCode, uint16_t timeout) {
+    // Polling: command code, system code, request code (system code), time slot
+    uint8_t polling[5] = {FELICA_CMD_POLLING, 0x00, 0x00, 0x01, 0x00};
+    
+    polling[1] = systemCode >> 8;
+    polling[2] = systemCode;
+    if (!listTargets(baudRate, polling, sizeof(polling), timeout, MIFARE_FELICA_READSIZE))
+        return 0;
+    
+    /* FeliCa response, for every tag after the count in b7:
+     
+     byte            Description
+     -------------   ------------------------------------------
+     b0              Tag Number
+     b1              POL_RES length, counting itself
+     b2              response code 01
+     b3..10          IDm
+     b11..18         PMm
+     b19..20         system code, when the card returns it */
+    
+    uint8_t found = packetbuffer[7];
+    if (found == 0 || found > MIFARE_MAX_TARGETS)
+        return 0;
+    
+    uint8_t end = 5 + packetbuffer[3];
+    if (end > listedSize)
+        end = listedSize;
+    uint8_t position = 8;
+    
+    for (uint8_t n = 0; n < found; n++) {
+        MIFARE_TARGET * t = &sessions[n].target;
+        
+        if (position + 2 > end || packetbuffer[position + 1] < 18 || position + 1 + packetbuffer[position + 1] > end)
+            break;
+        
+        t->tg = packetbuffer[position];
+        t->atqa = 0;
+        t->sak = 0;
+        t->type = MIFARE_FELICA;
+        t->uidLength = 8;
+        memcpy(t->uid, packetbuffer + position + 3, 8);
+        position += 1 + packetbuffer[position + 1];
+        
 #ifdef MIFAREDEBUG
-    Serial.print("card type:");
+        Serial.print("Tg: "); Serial.println(t->tg, DEC);
+        Serial.print("IDm:");
+        for (uint8_t i=0; i< 8; i++) {
+            Serial.print(" 0x");Serial.print(t->uid[i], HEX);
+        }
+        Serial.println("");
 #endif
-    switch (cardType) {
-        case MIFARE_CLASSIC:
-            return classic_readPayload(output, lengthLimit);
-            break;
-        case MIFARE_ULTRALIGHT:
-            return ultralight_readPayload(output, lengthLimit);
-            break;
-        default:
-            return false;
-            break;
+        sessions[n].state = MIFARE_SESSION_SELECTED;
+        sessions[n].mapped = false;
+        sessions[n].formatted = false;
+        targetCount++;
     }
+    
+    if (!useTarget(1))
+        return 0;
+    
+    return target->uid;
 }
 
-/*
- reads a mifare classic payload and re-assembles into a byte array
- reads block 4 - 64
- skips the sector footers
+
+/**************************************************************************/
+/*!
+ Collects the UIDs of every ISO14443A tag in the field. Each round lists
+ up to MIFARE_MAX_TARGETS tags and releases them with InRelease, which
+ halts them so the next round finds the others. It stops when a round
+ finds no tag or only known UIDs, then switches the field off and on to
+ wake the halted tags. Every session ends.
+ 
+ Call setPassiveActivationRetries first, the last round waits for a tag
+ for as long as the PN532 retries.
+ 
+ @param  inventory  uids and size set by the caller, the rest is filled in
+ @param  timeout    ms to wait for a round, 0 waits forever
+ 
+ @returns true if at least one tag was found
  */
-boolean Mifare::classic_readPayload (uint8_t * output, uint8_t lengthLimit){
-    uint8_t block_buffer[16] = {};
-    uint8_t position = 0;
-    boolean reading = 0;
+/**************************************************************************/
+boolean Mifare::inventory(MIFARE_INVENTORY * inventory, uint16_t timeout) {
+    unsigned long start = millis();
     
-    for (uint8_t i = 4; i <lengthLimit/16; i++) {
-        if(i%4 <3){
-            if(!classic_readMemoryBlock(i, block_buffer))
-                return false;
+    inventory->count = 0;
+    inventory->rounds = 0;
+    inventory->overflow = false;
+    
+    while (listTargets(MIFARE_ISO14443A, 0, 0, timeout, MIFARE_TARGETS_READSIZE)) {
+        uint8_t found = readTargetRecords();
+        uint8_t added = 0;
+        
+        inventory->rounds++;
+        if (found == 0)
+            break;
+        
+        for (uint8_t n = 0; n < found; n++) {
+            MIFARE_TARGET * t = &sessions[n].target;
+            uint8_t i = 0;
             
-            for (uint8_t n = 0; n < 16; n++) {
-                if (block_buffer[n] == STOP_BYTE) {
-                    i = 65;
-                    n = 17;
-                    return true;
-                }else{
-                    if(block_buffer[n] != 0)
-                        reading = true;
-                    if(reading){
-                        memcpy(output+position, block_buffer+n, 1);
-                        position ++;
-                    }
-                }
+            while (i < inventory->count && (inventory->uids[i].length != t->uidLength || memcmp(inventory->uids[i].uid, t->uid, t->uidLength) != 0))
+                i++;
+            if (i < inventory->count)
+                continue;
+            
+            // a full set can't tell new tags from known ones, they are counted as new
+            added++;
+            if (inventory->count == inventory->size) {
+                inventory->overflow = true;
+                continue;
             }
+            inventory->uids[i].length = t->uidLength;
+            memcpy(inventory->uids[i].uid, t->uid, t->uidLength);
+            inventory->count++;
         }
+        
+        targetCommand(PN532_COMMAND_INRELEASE, 0);
+        if (added == 0)
+            break;
     }
-    return false;
+    
+    for (uint8_t n = 0; n < MIFARE_MAX_TARGETS; n++)
+        sessions[n].state = MIFARE_SESSION_IDLE;
+    session = 0;
+    target = 0;
+    targetCount = 0;
+    setField(false);
+    delay(MIFARE_FIELD_OFF_TIME);
+    setField(true);
+    
+    inventory->time = millis() - start;
+    inventory->rate = inventory->time ? (uint32_t)inventory->count * 1000 / inventory->time : 0;
+    return inventory->count > 0;
 }
 
 
-/*
- reads a mifare ultralight payload and re-assembles into a byte array
- reads page 4 - 64
+/**************************************************************************/
+/*!
+ Waits for a target like readTarget and opens a session on it. The session
+ keeps the target selected so reads and writes don't detect it again.
+ 
+ @returns the session of the first target found, or 0 if it fails
  */
-boolean Mifare::ultralight_readPayload (uint8_t * output, uint8_t lengthLimit){
-    uint8_t block_buffer[4] = {};
-    uint8_t position = 0;
+/**************************************************************************/
+MIFARE_SESSION * Mifare::detect(uint16_t timeout) {
+    if (!readTarget(timeout))
+        return 0;
     
-    for (uint8_t i = 4; i <lengthLimit/4; i++) {
-        if(!ultralight_readMemoryBlock(i, block_buffer))
-            return false;
-        
-        for (uint8_t n = 0; n < 4; n++) {
-            if (block_buffer[n] == STOP_BYTE) {
-                i = 65;
-                n = 5;
-                return true;
-            }else{
-                memcpy(output+position, block_buffer+n, 1);
-                position ++;
-            }
-        }
-    }
-    return false;
+    return session;
 }
 
 
-/* write payload */
+/**************************************************************************/
+/*!
+ Waits for a FeliCa target like readFeliCaTarget, polling for type 3 tags,
+ and opens a session on it
+ 
+ @returns the session of the first target found, or 0 if it fails
+ */
+/**************************************************************************/
+MIFARE_SESSION * Mifare::detectFeliCa(uint8_t baudRate, uint16_t timeout) {
+    if (!readFeliCaTarget(baudRate, FELICA_SYSTEM_NDEF, timeout))
+        return 0;
+    
+    return session;
+}
 
-//get type of card and write the payload using either classic or ultralight
-//assumes payload is pre-formated with its own header
 
-boolean Mifare::writePayload (uint8_t *payload, uint8_t length){
-    if (!readTarget())
+/**************************************************************************/
+/*!
+ @param  number   1 for the first target, 2 for the second
+ 
+ @returns the session of a target found by the last detection, or 0
+ */
+/**************************************************************************/
+MIFARE_SESSION * Mifare::getSession(uint8_t number) {
+    if (number == 0 || number > targetCount)
+        return 0;
+    
+    return &sessions[number - 1];
+}
+
+
+/**************************************************************************/
+/*!
+ Selects the session's target with InSelect, which also brings back a
+ target that was deselected or dropped out after an error, without a new
+ detection. The session becomes the active one.
+ 
+ @returns true if the target answered
+ */
+/**************************************************************************/
+boolean Mifare::select(MIFARE_SESSION * s) {
+    if (!s || s->state == MIFARE_SESSION_IDLE)
         return false;
     
-    switch (cardType) {
-        case MIFARE_CLASSIC:
-            if(! classic_formatForNDEF())
-                return false;
-            return classic_writePayload(payload, length);
-            break;
-        case MIFARE_ULTRALIGHT:
-            return ultralight_writePayload(payload, length);
-            break;
-        default:
-            return false;
-            break;
-    }
+    if (!targetCommand(PN532_COMMAND_INSELECT, s->target.tg))
+        return false;
+    
+    s->state = MIFARE_SESSION_SELECTED;
+    session = s;
+    target = &s->target;
+    cardType = target->type;
+    return true;
 }
 
-/*
- writes a payload to a mifare classic
- starts in block 4
- blocks are 16 bytes long
- writes in sectors of 4 blocks
- every 4th writes a pre-defined sector footer which contains a security key which is hardcoded right 
+
+/**************************************************************************/
+/*!
+ Deselects the session's target with InDeselect, the PN532 keeps its
+ information so select can pick it up again
+ */
+/**************************************************************************/
+boolean Mifare::deselect(MIFARE_SESSION * s) {
+    if (!s || s->state != MIFARE_SESSION_SELECTED)
+        return false;
+    
+    if (!targetCommand(PN532_COMMAND_INDESELECT, s->target.tg))
+        return false;
+    
+    s->state = MIFARE_SESSION_DESELECTED;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Ends the session, InRelease makes the PN532 forget the target
+ */
+/**************************************************************************/
+boolean Mifare::release(MIFARE_SESSION * s) {
+    if (!s || s->state == MIFARE_SESSION_IDLE)
+        return false;
+    
+    s->state = MIFARE_SESSION_IDLE;
+    if (s == session){
+        session = 0;
+        target = 0;
+    }
+    return targetCommand(PN532_COMMAND_INRELEASE, s->target.tg);
+}
+
+
+/**************************************************************************/
+/*!
+ Checks with a single exchange that the session's target is still in the
+ field: Diagnose attention request for ISO14443-4 targets, a one page READ
+ on ultralight. On classic a block of the sector still authenticated is
+ read again; without one, sector 0 is authenticated. The card answers even
+ when the key is wrong (error 14h), it is then selected again, a second
+ exchange.
+ 
+ @returns false if the target doesn't answer
+ */
+/**************************************************************************/
+boolean Mifare::checkPresence(MIFARE_SESSION * s) {
+    uint8_t page[4];
+    uint8_t block[16];
+    
+    if (!activate(s))
+        return false;
+    
+    if (target->sak & 0x20){
+        packetbuffer[0] = PN532_COMMAND_DIAGNOSE;
+        packetbuffer[1] = 0x06;     // attention request or card presence test
+        
+        if (! board->sendCommandCheckAck(packetbuffer, 2))
+            return false;
+        board->readdata(packetbuffer, 10);
+        return (packetbuffer[6] == PN532_COMMAND_DIAGNOSE + 1) && ((packetbuffer[7] & 0x3F) == 0x00);
+    }
+    if (cardType == MIFARE_ULTRALIGHT)
+        return ultralight_read(0, page, 4);
+    if (cardType == MIFARE_FELICA){
+        // Request Response: length, command code, IDm
+        packetbuffer[2] = 10;
+        packetbuffer[3] = FELICA_CMD_REQUEST_RESPONSE;
+        memcpy(packetbuffer + 4, target->uid, 8);
+        return felica_exchange(10, FELICA_CMD_REQUEST_RESPONSE + 1);
+    }
+    if (authTarget == target && authSector != 0xFF)
+        return classic_readBlock((authSector < 32) ? authSector * 4 : 128 + (authSector - 32) * 16, block);
+    if (classic_authenticate(0, useKey, (useKey == KEY_A) ? keyA : keyB)){
+        authTarget = target;
+        authSector = 0;
+        return true;
+    }
+    // a timeout (error 01h) means nothing answered
+    if (packetbuffer[6] != 0x41 || (packetbuffer[7] & 0x3F) != 0x14)
+        return false;
+    return targetCommand(PN532_COMMAND_INSELECT, target->tg);
+}
+
+
+/**************************************************************************/
+/*!
+ Sends InSelect, InDeselect or InRelease for target tg
+ 
+ @returns true if the PN532 reports success
+ */
+/**************************************************************************/
+boolean Mifare::targetCommand(uint8_t command, uint8_t tg) {
+    forgetAuthentication();
+    packetbuffer[0] = command;
+    packetbuffer[1] = tg;
+    
+    if (! board->sendCommandCheckAck(packetbuffer, 2))
+        return false;
+    
+    board->readdata(packetbuffer, 10);
+    
+    // the low 6 bits of the status byte hold the error code
+    return (packetbuffer[6] == command + 1) && ((packetbuffer[7] & 0x3F) == 0x00);
+}
+
+
+/**************************************************************************/
+/*!
+ Makes s the active session, selecting its target again if it was
+ deselected
+ */
+/**************************************************************************/
+boolean Mifare::activate(MIFARE_SESSION * s) {
+    if (!s || s->state == MIFARE_SESSION_IDLE)
+        return false;
+    if (s->state == MIFARE_SESSION_DESELECTED)
+        return select(s);
+    
+    session = s;
+    target = &s->target;
+    cardType = target->type;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Gets the active target back after a failed block operation. A failed
+ authentication or a card error leaves the card halted, InSelect wakes it
+ up and selects it again, so the operation can be retried in place.
+ 
+ @param  attempt   retries done so far for this block
+ 
+ @returns false once the retries are used up, or when the target is gone
+ (the session then ends)
+ */
+/**************************************************************************/
+boolean Mifare::recover(uint8_t attempt) {
+    if (attempt >= retries || !session)
+        return false;
+    if (targetCommand(PN532_COMMAND_INSELECT, target->tg))
+        return true;
+    
+    session->state = MIFARE_SESSION_IDLE;
+    return false;
+}
+
+
+/*
+ CRC-8 of the MAD, polynomial 0x1D with 0xC7 as start value, over the
+ info byte and the AIDs
+ */
+static uint8_t madCrc (uint8_t * data, uint8_t length){
+    uint8_t crc = 0xC7;
+    
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t b = 0; b < 8; b++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+    }
+    return crc;
+}
+
+
+/*
+ MAD version 1 in sector 0 and version 2 in sector 16 of a 4K card, with
+ every sector given to the NDEF application (AID 0x03E1)
+ */
+static const uint8_t madBlock1[16] = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+static const uint8_t madBlock2[16] = {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+static const uint8_t madBlock64[16] = {0x9E, 0x00, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+static const uint8_t madTrailer[16] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/*
+ gives the card to NDEF. a card with a valid MAD keeps its other
+ applications: only free sectors (AID 0x0000) are given to NDEF, as many
+ as length needs, and the write fails when there aren't enough. a card
+ without one gets the MAD below.
+ */
+boolean Mifare::classic_formatForNDEF (uint16_t length){
+    uint8_t mad[48];
+    
+    for (uint8_t attempt = 0; !classic_readDirectoryBlocks(1, mad); attempt++){
+        if (!recover(attempt))
+            return false;
+    }
+    if (madCrc(mad + 1, 31) == mad[0])
+        return classic_allocateSectors(mad, length);
+    
+    uint8_t sectorbuffer1[16];
+    uint8_t sectorbuffer2[16];
+    uint8_t sectorbuffer3[16];
+    uint8_t sectorbuffer64[16];
+    
+    memcpy(sectorbuffer1, madBlock1, 16);
+    memcpy(sectorbuffer2, madBlock2, 16);
+    memcpy(sectorbuffer3, madTrailer, 16);
+    memcpy(sectorbuffer64, madBlock64, 16);
+    
+    // on a 4K card the GPB points to MAD version 2
+    if (cardType == MIFARE_CLASSIC_4K)
+        sectorbuffer3[9] = 0xC2;
+    
+    // Write block 1 and 2 to the card
+    if (!(classic_updateMemoryBlock (1, sectorbuffer1)))
+        return false;
+    if (!(classic_updateMemoryBlock (2, sectorbuffer2)))
+        return false;
+    // Write key A and access rights card
+    if (!(classic_updateMemoryBlock (3, sectorbuffer3)))
+        return false;
+    
+    if (cardType == MIFARE_CLASSIC_4K){
+        // MAD2 in sector 16 maps sectors 17..39 to NDEF
+        if (!(classic_updateMemoryBlock (64, sectorbuffer64)))
+            return false;
+        if (!(classic_updateMemoryBlock (65, sectorbuffer2)))
+            return false;
+        if (!(classic_updateMemoryBlock (66, sectorbuffer2)))
+            return false;
+        if (!(classic_updateMemoryBlock (67, sectorbuffer3)))
+            return false;
+    }
+//    Serial.println("FORMATTED");
+    
+    classic_mapAllSectors();
+    session->formatted = true;
+    
+    // Seems that everything was OK (?!)
+    return true;
+}
+
+
+/*
+ marks free sectors of the MAD in mad (MAD1, blocks 1..2) as NDEF until
+ they hold length bytes, then writes the MAD back. on a 4K card sectors
+ 17..39 are only used when MAD2 is valid. nothing is written when the free
+ sectors are too small.
+ */
+boolean Mifare::classic_allocateSectors (uint8_t * mad, uint16_t length){
+    uint8_t mad2[48];
+    boolean extended = false;
+    uint16_t size = 0;
+    
+    memset(session->sectors, 0, MIFARE_SECTOR_MAP_SIZE);
+    if (cardType == MIFARE_CLASSIC_4K){
+        for (uint8_t attempt = 0; !classic_readDirectoryBlocks(64, mad2); attempt++){
+            if (!recover(attempt))
+                return false;
+        }
+        extended = (madCrc(mad2 + 1, 47) == mad2[0]);
+    }
+    
+    for (uint8_t sector = 1; sector < 40 && size < length; sector++){
+        uint8_t * aid;
+        
+        if (sector == 16 || (sector > 16 && !extended))
+            continue;
+        aid = (sector < 16) ? mad + sector * 2 : mad2 + (sector - 16) * 2;
+        if (aid[0] != 0x00 || aid[1] != 0x00)
+            continue;
+        
+        aid[0] = 0x03;
+        aid[1] = 0xE1;
+        session->sectors[sector >> 3] |= 1 << (sector & 7);
+        size += (sector < 32) ? 48 : 240;
+    }
+    if (size < length)
+        return false;
+    
+    mad[0] = madCrc(mad + 1, 31);
+    if (!classic_updateMemoryBlock(1, mad) || !classic_updateMemoryBlock(2, mad + 16))
+        return false;
+    if (extended){
+        mad2[0] = madCrc(mad2 + 1, 47);
+        for (uint8_t i = 0; i < 3; i++){
+            if (!classic_updateMemoryBlock(64 + i, mad2 + i * 16))
+                return false;
+        }
+    }
+    
+    session->formatted = true;
+    return true;
+}
+
+
+/*
+ reads the MIFARE Application Directory and marks the sectors holding the
+ NDEF application (AID 0xE103, stored as 03 E1) in the session's sector
+ map. MAD1 in blocks 1..2 covers sectors 1..15, MAD2 in blocks 64..66 of
+ a 4K card covers sectors 17..39.
+ 
+ a card without a valid MAD gets every sector, the layout this library
+ used before it read the MAD, and isn't marked as formatted.
+ 
+ returns false only when the card can't be read
+ */
+boolean Mifare::classic_readDirectory (){
+    uint8_t mad[48];
+    uint8_t found = 0;
+    
+    for (uint8_t attempt = 0; !classic_readDirectoryBlocks(1, mad); attempt++){
+        if (!recover(attempt))
+            return false;
+    }
+    
+    memset(session->sectors, 0, MIFARE_SECTOR_MAP_SIZE);
+    session->mapped = true;
+    session->formatted = false;
+    
+    if (madCrc(mad + 1, 31) != mad[0]){
+        classic_mapAllSectors();
+        return true;
+    }
+    for (uint8_t sector = 1; sector < 16; sector++){
+        if (mad[sector * 2] == 0x03 && mad[sector * 2 + 1] == 0xE1){
+            session->sectors[sector >> 3] |= 1 << (sector & 7);
+            found++;
+        }
+    }
+    
+    if (cardType == MIFARE_CLASSIC_4K){
+        for (uint8_t attempt = 0; !classic_readDirectoryBlocks(64, mad); attempt++){
+            if (!recover(attempt))
+                return false;
+        }
+        if (madCrc(mad + 1, 47) == mad[0]){
+            for (uint8_t sector = 17; sector < 40; sector++){
+                if (mad[(sector - 16) * 2] == 0x03 && mad[(sector - 16) * 2 + 1] == 0xE1){
+                    session->sectors[sector >> 3] |= 1 << (sector & 7);
+                    found++;
+                }
+            }
+        }
+    }
+    
+    session->formatted = (found > 0);
+    return true;
+}
+
+
+/*
+ reads the MAD blocks of the sector starting at blockaddress (2 of them in
+ sector 0, 3 in sector 16) into data, with the public MAD key A when it
+ works and the configured keys otherwise
+ */
+boolean Mifare::classic_readDirectoryBlocks (uint8_t blockaddress, uint8_t * data){
+    const uint8_t madKey[6] = MIFARE_KEY_MAD;
+    uint8_t count = (blockaddress == 1) ? 2 : 3;
+    
+    if (classic_authenticate(blockaddress, KEY_A, madKey)){
+        for (uint8_t i = 0; i < count; i++){
+            if (!classic_readBlock(blockaddress + i, data + i * 16))
+                return false;
+        }
+        return true;
+    }
+    
+    // the failed authentication halted the card
+    if (!targetCommand(PN532_COMMAND_INSELECT, target->tg))
+        return false;
+    for (uint8_t i = 0; i < count; i++){
+        if (!classic_readMemoryBlock(blockaddress + i, data + i * 16))
+            return false;
+    }
+    return true;
+}
+
+
+/*
+ gives every sector but the MAD sectors to NDEF, the layout written by
+ classic_formatForNDEF
+ */
+void Mifare::classic_mapAllSectors (){
+    uint8_t sectorCount = (cardType == MIFARE_CLASSIC_4K) ? 40 : 16;
+    
+    memset(session->sectors, 0, MIFARE_SECTOR_MAP_SIZE);
+    for (uint8_t sector = 1; sector < sectorCount; sector++){
+        if (sector != 16)
+            session->sectors[sector >> 3] |= 1 << (sector & 7);
+    }
+    session->mapped = true;
+}
+
+
+/*
+ size in bytes of the NDEF sectors in the session's sector map
+ */
+uint16_t Mifare::classic_mapSize (){
+    uint16_t size = 0;
+    
+    for (uint8_t sector = 1; sector < 40; sector++){
+        if (session->sectors[sector >> 3] & (1 << (sector & 7)))
+            size += (sector < 32) ? 48 : 240;
+    }
+    return size;
+}
+
+
+/*
+ CRC-16/CCITT, used for tag fingerprints
+ */
+static uint16_t crc16 (uint8_t * data, uint8_t length){
+    uint16_t crc = 0xFFFF;
+    
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+
+/*
+ cheap fingerprint of the tag content, a CRC of the first 16 bytes of the
+ NDEF data area, which hold the message TLV header and the start of the
+ message. on ultralight the read starts at the capability container and
+ takes a single exchange. changes past those bytes that keep the message
+ length aren't seen.
+ 
+ on classic the first data block comes from the MAD, which a new session
+ hasn't read yet: that takes an authentication and 2 READs (3 more for
+ MAD2 on a 4K card) before the authentication and READ of the block.
+ block is the classic block the fingerprint was read from, pass the one
+ a previous call returned (ie kept with a cache entry) to read it straight
+ away, or 0 to find it in the MAD. a block that can't be read any more is
+ looked up in the MAD again.
+ */
+boolean Mifare::readFingerprint (MIFARE_SESSION * s, uint16_t * fingerprint){
+    uint8_t block = 0;
+    
+    return readFingerprint(s, fingerprint, &block);
+}
+
+boolean Mifare::readFingerprint (MIFARE_SESSION * s, uint16_t * fingerprint, uint8_t * block){
+    uint8_t block_buffer[16];
+    boolean success;
+    
+    if (!activate(s))
+        return false;
+    
+    switch (cardType) {
+        case MIFARE_CLASSIC:
+        case MIFARE_CLASSIC_4K:
+            if (!session->mapped && *block != 0){
+                if (classic_readMemoryBlock(*block, block_buffer)){
+                    success = true;
+                    break;
+                }
+                // the failed authentication or READ halted the card
+                if (!targetCommand(PN532_COMMAND_INSELECT, target->tg))
+                    return false;
+            }
+            success = (session->mapped || classic_readDirectory()) &&
+                      classic_readMemoryBlock(classic_dataBlock(0), block_buffer);
+            *block = classic_dataBlock(0);
+            break;
+        case MIFARE_ULTRALIGHT:
+            success = ultralight_readPages(3, block_buffer);
+            break;
+        default:
+            success = false;
+            break;
+    }
+    if (!success)
+        return false;
+    
+    *fingerprint = crc16(block_buffer, 16);
+    return true;
+}
+
+
+/* value blocks */
+
+/*
+ sector of a classic block address, sectors 32..39 of a 4K card have 16 blocks
+ */
+static uint8_t classicSector (uint8_t blockaddress){
+    return (blockaddress < 128) ? blockaddress / 4 : 32 + (blockaddress - 128) / 16;
+}
+
+/*
+ value blocks can't be block 0 or a sector trailer
+ */
+static boolean isValueBlock (uint8_t blockaddress){
+    uint8_t last = (blockaddress < 128) ? 3 : 15;
+    return blockaddress != 0 && (blockaddress & last) != last;
+}
+
+
+/**************************************************************************/
+/*!
+ Writes a classic value block holding value, with the block address as the
+ address byte (used by some readers to point at a backup block)
+ 
+ The value is stored little endian three times, once inverted, so that
+ INCREMENT, DECREMENT, RESTORE and TRANSFER accept the block.
+ */
+/**************************************************************************/
+boolean Mifare::formatValue (MIFARE_SESSION * s, uint8_t blockaddress, int32_t value){
+    uint8_t block_buffer[16];
+    
+    if (!activate(s))
+        return false;
+    if ((cardType != MIFARE_CLASSIC && cardType != MIFARE_CLASSIC_4K) || !isValueBlock(blockaddress))
+        return false;
+    
+    for (uint8_t i = 0; i < 4; i++) {
+        block_buffer[i] = (uint32_t)value >> (8 * i);
+        block_buffer[i + 4] = ~block_buffer[i];
+        block_buffer[i + 8] = block_buffer[i];
+    }
+    block_buffer[12] = blockaddress;
+    block_buffer[13] = ~blockaddress;
+    block_buffer[14] = blockaddress;
+    block_buffer[15] = ~blockaddress;
+    
+    return classic_writeMemoryBlock(blockaddress, block_buffer);
+}
+
+
+/**************************************************************************/
+/*!
+ Reads a value block
+ 
+ @returns false if the block doesn't hold a valid value, the three copies
+ of the value and the address must agree
+ */
+/**************************************************************************/
+boolean Mifare::readValue (MIFARE_SESSION * s, uint8_t blockaddress, int32_t * value){
+    uint8_t block_buffer[16];
+    
+    if (!activate(s))
+        return false;
+    if ((cardType != MIFARE_CLASSIC && cardType != MIFARE_CLASSIC_4K) || !isValueBlock(blockaddress))
+        return false;
+    if (!classic_readMemoryBlock(blockaddress, block_buffer))
+        return false;
+    
+    for (uint8_t i = 0; i < 4; i++) {
+        if (block_buffer[i] != (uint8_t)~block_buffer[i + 4] || block_buffer[i] != block_buffer[i + 8])
+            return false;
+    }
+    if (block_buffer[12] != block_buffer[14] || block_buffer[13] != block_buffer[15] ||
+        block_buffer[12] != (uint8_t)~block_buffer[13])
+        return false;
+    
+    *value = (int32_t)((uint32_t)block_buffer[0] | (uint32_t)block_buffer[1] << 8 |
+                       (uint32_t)block_buffer[2] << 16 | (uint32_t)block_buffer[3] << 24);
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Adds delta to a value block on the card, one authentication, one INCREMENT
+ and one TRANSFER instead of a read and a write
+ 
+ The result goes to destination, which has to be in the same sector. the
+ short form writes it back to blockaddress.
+ */
+/**************************************************************************/
+boolean Mifare::incrementValue (MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta){
+    return incrementValue(s, blockaddress, delta, blockaddress);
+}
+
+boolean Mifare::incrementValue (MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta, uint8_t destination){
+    if (!activate(s))
+        return false;
+    return classic_valueOperation(MIFARE_CMD_INCREMENT, blockaddress, delta, destination);
+}
+
+
+/**************************************************************************/
+/*!
+ Subtracts delta from a value block, see incrementValue. the card refuses
+ to go below the smallest value
+ */
+/**************************************************************************/
+boolean Mifare::decrementValue (MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta){
+    return decrementValue(s, blockaddress, delta, blockaddress);
+}
+
+boolean Mifare::decrementValue (MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta, uint8_t destination){
+    if (!activate(s))
+        return false;
+    return classic_valueOperation(MIFARE_CMD_DECREMENT, blockaddress, delta, destination);
+}
+
+
+/**************************************************************************/
+/*!
+ Copies the value of blockaddress to destination in the same sector with
+ RESTORE and TRANSFER, to keep or bring back a backup of a counter
+ */
+/**************************************************************************/
+boolean Mifare::restoreValue (MIFARE_SESSION * s, uint8_t blockaddress, uint8_t destination){
+    if (!activate(s))
+        return false;
+    return classic_valueOperation(MIFARE_CMD_STORE, blockaddress, 0, destination);
+}
+
+
+/*
+ INCREMENT, DECREMENT or RESTORE (MIFARE_CMD_STORE) of blockaddress into the
+ card's transfer buffer, then TRANSFER to destination
+ */
+boolean Mifare::classic_valueOperation (uint8_t command, uint8_t blockaddress, uint32_t operand, uint8_t destination){
+    uint8_t operation[6];
+    
+    if (cardType != MIFARE_CLASSIC && cardType != MIFARE_CLASSIC_4K)
+        return false;
+    if (!isValueBlock(blockaddress) || !isValueBlock(destination) ||
+        classicSector(blockaddress) != classicSector(destination))
+        return false;
+    
+    if (!classic_authenticateBlock(blockaddress))
+        return false;
+    
+    // the PN532 sends the operand as the second part of the command
+    operation[0] = command;
+    operation[1] = blockaddress;
+    for (uint8_t i = 0; i < 4; i++)
+        operation[2 + i] = operand >> (8 * i);
+    if (!classic_dataExchange(operation, 6))
+        return false;
+    
+    operation[0] = MIFARE_CMD_TRANSFER;
+    operation[1] = destination;
+    return classic_dataExchange(operation, 2);
+}
+
+
+/*
+ InDataExchange of a classic command without response data
+ */
+boolean Mifare::classic_dataExchange (uint8_t * command, uint8_t length){
+    packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
+    packetbuffer[1] = target->tg;
+    memcpy(packetbuffer + 2, command, length);
+    
+    if (! board->sendCommandCheckAck(packetbuffer, length + 2))
+        return false;
+    
+    board->readdata(packetbuffer, 10);
+    
+#ifdef MIFAREDEBUG
+    Serial.print("VALUE ");
+    for(uint8_t i=0;i<10;i++) {
+        Serial.print(packetbuffer[i], HEX); Serial.print(" ");
+    }
+    Serial.println("");
+#endif
+    
+    if ((packetbuffer[6] == 0x41) && ((packetbuffer[7] & 0x3F) == 0x00))
+        return true;
+    forgetAuthentication();
+    return false;
+}
+
+
+/* batch operations */
+
+/*
+ what execute sorts operations by, the classic sector or the ultralight page
+ */
+static uint8_t operationKey (MIFARE_OP * op){
+    return (Mifare::cardType == MIFARE_ULTRALIGHT) ? op->blockaddress : classicSector(op->blockaddress);
+}
+
+
+/**************************************************************************/
+/*!
+ Runs a list of block reads and writes on the session's target in one call
+ 
+ The operations are first sorted (stable, in place) by sector on classic
+ and by page on ultralight, so that every classic sector is authenticated
+ once and every ultralight READ serves up to four page reads. Operations
+ on the same block keep their order. They are then sent back to back,
+ reading straight into and writing straight from the callers' buffers.
+ 
+ A failed operation doesn't stop the batch, the card is selected again
+ and the next operation goes on. Check the success field of every
+ operation.
+ 
+ @returns true if every operation succeeded
+ */
+/**************************************************************************/
+boolean Mifare::execute (MIFARE_SESSION * s, MIFARE_OP * ops, uint8_t count){
+    uint8_t pages[16];
+    uint8_t pagesAddress = 0;
+    boolean pagesLoaded = false;
+    boolean all = true;
+    
+    if (!activate(s))
+        return false;
+    if (cardType != MIFARE_CLASSIC && cardType != MIFARE_CLASSIC_4K && cardType != MIFARE_ULTRALIGHT)
+        return false;
+    
+    // insertion sort, the lists are short and it keeps equal keys in order
+    for (uint8_t i = 1; i < count; i++){
+        MIFARE_OP op = ops[i];
+        uint8_t key = operationKey(&op);
+        uint8_t j = i;
+        
+        while (j > 0 && operationKey(&ops[j - 1]) > key){
+            ops[j] = ops[j - 1];
+            j--;
+        }
+        ops[j] = op;
+    }
+    
+    for (uint8_t i = 0; i < count; i++){
+        MIFARE_OP * op = &ops[i];
+        
+        if (cardType == MIFARE_ULTRALIGHT){
+            if (op->operation == MIFARE_OP_WRITE){
+                op->success = ultralight_writeMemoryBlock(op->blockaddress, op->data);
+                // the page may be part of the last READ
+                if (op->success && pagesLoaded && (uint8_t)(op->blockaddress - pagesAddress) < 4)
+                    memcpy(pages + (op->blockaddress - pagesAddress) * 4, op->data, 4);
+            }else{
+                if (!pagesLoaded || (uint8_t)(op->blockaddress - pagesAddress) >= 4){
+                    pagesLoaded = ultralight_readPages(op->blockaddress, pages);
+                    pagesAddress = op->blockaddress;
+                }
+                op->success = pagesLoaded;
+                if (op->success)
+                    memcpy(op->data, pages + (op->blockaddress - pagesAddress) * 4, 4);
+            }
+        }else{
+            if (op->operation == MIFARE_OP_WRITE)
+                op->success = classic_writeMemoryBlock(op->blockaddress, op->data);
+            else
+                op->success = classic_readMemoryBlock(op->blockaddress, op->data);
+            
+            // a failed authentication or command halts the card
+            if (!op->success && !targetCommand(PN532_COMMAND_INSELECT, target->tg)){
+                for (; i < count; i++)
+                    ops[i].success = false;
+                return false;
+            }
+        }
+        all = all && op->success;
+    }
+    return all;
+}
+
+
+/* read payload */
+
+//readPayload(output, lengthLimit) uses the active target, or detects one when there is none
+//get type of card and size, then either classic or ultralight read all the blocks
+//output is a char array buffer to write output into
+
+struct PayloadBuffer {
+    uint8_t * output;
+    uint16_t lengthLimit;
+    uint8_t header_length;
+};
+
+/*
+ block callback used by readPayload, writes the NDEF message TLV header on the
+ first chunk and copies every chunk after it
+ */
+static boolean copyPayloadChunk (uint8_t * data, uint8_t length, uint16_t offset, uint16_t total, void * context){
+    PayloadBuffer * buffer = (PayloadBuffer *)context;
+    
+    if (offset == 0){
+        buffer->output[0] = NDEF_TLV_MESSAGE;
+        if (total < NDEF_TLV_LONG_LENGTH){
+            buffer->output[1] = total;
+            buffer->header_length = 2;
+        }else{
+            buffer->output[1] = NDEF_TLV_LONG_LENGTH;
+            buffer->output[2] = total >> 8;
+            buffer->output[3] = total;
+            buffer->header_length = 4;
+        }
+        if (buffer->header_length + total > buffer->lengthLimit)
+            return false;
+    }
+    memcpy(buffer->output + buffer->header_length + offset, data, length);
+    return true;
+}
+
+boolean Mifare::readPayload (uint8_t * output, uint16_t lengthLimit){
+    PayloadBuffer buffer = { output, lengthLimit, 0 };
+    
+    return streamPayload(copyPayloadChunk, &buffer);
+}
+
+boolean Mifare::readPayload (MIFARE_SESSION * s, uint8_t * output, uint16_t lengthLimit){
+    PayloadBuffer buffer = { output, lengthLimit, 0 };
+    
+    return streamPayload(s, copyPayloadChunk, &buffer);
+}
+
+
+/*
+ reads the NDEF message and hands it to callback as it arrives from the card,
+ one read at a time, up to MIFARE_CHUNK_MAX bytes. callback gets the chunk,
+ its offset in the message and the total message length, and can return
+ false to stop reading.
+ an empty message is reported with a single zero length chunk.
+ */
+boolean Mifare::streamPayload (MIFARE_BLOCK_CALLBACK callback, void * context){
+    if (!session && !detect())
+        return false;
+    
+    // the tag may have left the field, detect again next time
+    if (!streamPayload(session, callback, context)){
+        session = 0;
+        target = 0;
+        return false;
+    }
+    return true;
+}
+
+/*
+ streams the payload of the session's target. a block that fails is read
+ again after selecting the target with InSelect (see recover), the stream
+ resumes where it stopped. if the target can't be selected the session ends
+ */
+boolean Mifare::streamPayload (MIFARE_SESSION * s, MIFARE_BLOCK_CALLBACK callback, void * context){
+    if (!activate(s))
+        return false;
+    return stream(callback, context);
+}
+
+boolean Mifare::stream (MIFARE_BLOCK_CALLBACK callback, void * context){
+#ifdef MIFAREDEBUG
+    Serial.print("card type:");
+#endif
+    switch (cardType) {
+        case MIFARE_CLASSIC:
+        case MIFARE_CLASSIC_4K:
+            return classic_streamPayload(callback, context);
+            break;
+        case MIFARE_ULTRALIGHT:
+            return ultralight_streamPayload(callback, context);
+            break;
+        case MIFARE_FELICA:
+            return type3_streamPayload(callback, context);
+            break;
+        default:
+            // DESFire and other ISO14443-4 tags, the PN532 did the RATS when listing them
+            if (target->sak & MIFARE_SAK_ISODEP)
+                return type4_streamPayload(callback, context);
+            return false;
+            break;
+    }
+}
+
+/*
+ streams a mifare classic payload
+ the NDEF data area is made of the sectors the MAD gives to NDEF, in order,
+ skipping the sector footers
+ */
+boolean Mifare::classic_streamPayload (MIFARE_BLOCK_CALLBACK callback, void * context){
+    if (!session->mapped && !classic_readDirectory())
+        return false;
+    dataSize = classic_mapSize();
+    
+    return streamMessageTLV(callback, context);
+}
+
+
+/*
+ streams the NDEF file of a type 4 tag: selects the NDEF tag application,
+ reads the capability container for the NDEF file and the largest READ
+ BINARY the tag takes (MLe), then reads the file with the largest Le that
+ fits both MLe and a response frame (frameSize). the first READ BINARY also returns NLEN,
+ the message length. ISO-DEP block chaining within a response is done by
+ the PN532.
+ */
+boolean Mifare::type4_streamPayload (MIFARE_BLOCK_CALLBACK callback, void * context){
+    static const uint8_t selectApplication[] = {0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00};
+    uint8_t * data;
+    uint8_t received;
+    
+    if (!type4_exchange(selectApplication, sizeof(selectApplication), &data, &received))
+        return false;
+    
+    // capability container: CCLEN, version, MLe, MLc, NDEF file control TLV (04 06 id size access)
+    if (!type4_selectFile(0xE103) || !type4_readBinary(0, 15, &data, &received) || received < 15 || data[7] != 0x04)
+        return false;
+    
+    uint16_t maxLe = (data[3] << 8) | data[4];
+    uint16_t fileID = (data[9] << 8) | data[10];
+    uint16_t fileSize = (data[11] << 8) | data[12];
+    uint8_t le = frameSize() - 12;    // frame header, status, SW1 SW2, checksum and postamble
+    if (maxLe != 0 && maxLe < le)
+        le = maxLe;
+    
+    // the first READ BINARY gets NLEN and what it can of the message, never past the file
+    uint8_t first = (fileSize < le) ? fileSize : le;
+    if (!type4_selectFile(fileID) || !type4_readBinary(0, first, &data, &received) || received < 2)
+        return false;
+    
+    uint16_t length = (data[0] << 8) | data[1];
+    
+#ifdef MIFAREDEBUG
+    Serial.print("NDEF file length: "); Serial.println(length, DEC);
+#endif
+    if (length + 2 > fileSize)
+        return false;
+    if (length == 0)
+        return callback(data, 0, 0, 0, context);
+    
+    uint16_t offset = 0;
+    data += 2;
+    received -= 2;
+    
+    while (true) {
+        uint8_t chunk = (received < length - offset) ? received : length - offset;
+        
+        if (chunk == 0 || !callback(data, chunk, offset, length, context))
+            return false;
+        offset += chunk;
+        if (offset == length)
+            return true;
+        
+        uint8_t next = (length - offset < le) ? length - offset : le;
+        if (!type4_readBinary(offset + 2, next, &data, &received))
+            return false;
+    }
+}
+
+
+/*
+ SELECT by file identifier, first or only occurrence, no response data
+ */
+boolean Mifare::type4_selectFile (uint16_t fileID){
+    uint8_t apdu[7] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0x00, 0x00};
+    uint8_t * data;
+    uint8_t received;
+    
+    apdu[5] = fileID >> 8;
+    apdu[6] = fileID;
+    return type4_exchange(apdu, 7, &data, &received);
+}
+
+
+/*
+ READ BINARY of length bytes at offset in the selected file. data points
+ into packetbuffer, valid until the next command.
+ */
+boolean Mifare::type4_readBinary (uint16_t offset, uint8_t length, uint8_t ** data, uint8_t * received){
+    uint8_t apdu[5] = {0x00, 0xB0, 0x00, 0x00, 0x00};
+    
+    apdu[2] = offset >> 8;
+    apdu[3] = offset;
+    apdu[4] = length;
+    return type4_exchange(apdu, 5, data, received);
+}
+
+
+/**************************************************************************/
+/*!
+ Sends an APDU to the active ISO14443-4 target with InDataExchange
+ 
+ @param  apdu            command APDU
+ @param  length          its length
+ @param  response        set to the response data in packetbuffer, without
+ the status word
+ @param  responseLength  length of the response data
+ 
+ @returns true if the PN532 and the tag (SW 90 00) report success
+ */
+/**************************************************************************/
+boolean Mifare::type4_exchange (const uint8_t * apdu, uint8_t length, uint8_t ** response, uint8_t * responseLength){
+    packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
+    packetbuffer[1] = target->tg;
+    memcpy(packetbuffer + 2, apdu, length);
+    
+    if (! board->sendCommandCheckAck(packetbuffer, length + 2))
+        return false;
+    
+    uint8_t frame = frameSize();
+    board->readdata(packetbuffer, frame);
+    
+#ifdef MIFAREDEBUG
+    Serial.print("APDU ");
+    for(uint8_t i=0;i<12;i++) {
+        Serial.print(packetbuffer[i], HEX); Serial.print(" ");
+    }
+    Serial.println("");
+#endif
+    
+    // LEN counts TFI, command code and status before the response APDU
+    if ((packetbuffer[6] != 0x41) || ((packetbuffer[7] & 0x3F) != 0x00))
+        return false;
+    if (packetbuffer[3] < 5 || packetbuffer[3] + 7 > frame)
+        return false;
+    
+    uint8_t received = packetbuffer[3] - 3;
+    if ((packetbuffer[6 + received] != 0x90) || (packetbuffer[7 + received] != 0x00))
+        return false;
+    
+    *response = packetbuffer + 8;
+    *responseLength = received - 2;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Reads blocks of a FeliCa service that needs no authentication, as many
+ per Read Without Encryption as fit in a response frame, or one at a time
+ when the target refuses that many. A block takes a 39 byte frame, more
+ than PN532_I2C reads through the AVR Wire buffer.
+ 
+ @param  s            session of a target found by detectFeliCa
+ @param  serviceCode  e.g. FELICA_SERVICE_NDEF_READ
+ @param  blockNumber  first block
+ @param  count        number of blocks
+ @param  output       count * 16 bytes
+ 
+ @returns false if the target isn't FeliCa or a read fails
+ */
+/**************************************************************************/
+boolean Mifare::readFeliCaBlocks(MIFARE_SESSION * s, uint16_t serviceCode, uint16_t blockNumber, uint8_t count, uint8_t * output) {
+    uint8_t * data;
+    uint8_t batch = felica_maxBlocks();
+    
+    if (!activate(s) || cardType != MIFARE_FELICA || batch == 0)
+        return false;
+    
+    while (count > 0) {
+        uint8_t n = (count < batch) ? count : batch;
+        if (!felica_readWithoutEncryption(serviceCode, blockNumber, n, &data)) {
+            // the target may take fewer blocks per command, go on one at a time
+            if (n == 1)
+                return false;
+            batch = 1;
+            continue;
+        }
+        memcpy(output, data, n * 16);
+        output += n * 16;
+        blockNumber += n;
+        count -= n;
+    }
+    return true;
+}
+
+
+/*
+ streams the NDEF message of a type 3 tag. block 0 of the NDEF service is
+ the attribute information block: version, Nbr (blocks per read), Nbw,
+ Nmaxb, WriteF, RWFlag, Ln (message length) and a checksum. the message
+ starts at block 1, read Nbr blocks at a time, or as many as fit in a
+ response frame.
+ */
+boolean Mifare::type3_streamPayload (MIFARE_BLOCK_CALLBACK callback, void * context){
+    uint8_t * data;
+    
+    if (!felica_readWithoutEncryption(FELICA_SERVICE_NDEF_READ, 0, 1, &data))
+        return false;
+    
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < 14; i++)
+        sum += data[i];
+    if (sum != ((data[14] << 8) | data[15]))
+        return false;
+    
+    uint8_t batch = data[1];
+    uint16_t maxBlocks = (data[3] << 8) | data[4];
+    uint32_t length = ((uint32_t)data[11] << 16) | (data[12] << 8) | data[13];
+    
+#ifdef MIFAREDEBUG
+    Serial.print("Type 3 message length: "); Serial.println(length, DEC);
+#endif
+    if (length > 0xFFFF || length > (uint32_t)maxBlocks * 16)
+        return false;
+    if (length == 0)
+        return callback(data, 0, 0, 0, context);
+    if (batch == 0 || batch > felica_maxBlocks())
+        batch = felica_maxBlocks();
+    
+    uint16_t offset = 0;
+    uint16_t block = 1;
+    
+    while (offset < length) {
+        uint16_t remaining = length - offset;
+        uint16_t blocks = (remaining + 15) / 16;
+        uint8_t count = (blocks > batch) ? batch : blocks;
+        
+        if (!felica_readWithoutEncryption(FELICA_SERVICE_NDEF_READ, block, count, &data))
+            return false;
+        
+        uint8_t chunk = (remaining < count * 16) ? remaining : count * 16;
+        if (!callback(data, chunk, offset, length, context))
+            return false;
+        offset += chunk;
+        block += count;
+    }
+    return true;
+}
+
+
+/*
+ Read Without Encryption of count consecutive blocks of one service. data
+ points into packetbuffer, valid until the next command.
+ */
+boolean Mifare::felica_readWithoutEncryption (uint16_t serviceCode, uint16_t blockNumber, uint8_t count, uint8_t ** data){
+    if (count == 0 || count > felica_maxBlocks())
+        return false;
+    
+    // length, command code, IDm, one service, its code (little endian), block count
+    uint8_t length = 14;
+    packetbuffer[3] = FELICA_CMD_READ_WITHOUT_ENCRYPTION;
+    memcpy(packetbuffer + 4, target->uid, 8);
+    packetbuffer[12] = 1;
+    packetbuffer[13] = serviceCode;
+    packetbuffer[14] = serviceCode >> 8;
+    packetbuffer[15] = count;
+    
+    // block list elements, 2 bytes for blocks below 256, 3 bytes above
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t block = blockNumber + i;
+        if (block < 0x100) {
+            packetbuffer[2 + length++] = 0x80;
+            packetbuffer[2 + length++] = block;
+        } else {
+            packetbuffer[2 + length++] = 0x00;
+            packetbuffer[2 + length++] = block;
+            packetbuffer[2 + length++] = block >> 8;
+        }
+    }
+    packetbuffer[2] = length;
+    
+    // response: length, code, IDm, status flags 1 and 2, block count, blocks
+    if (!felica_exchange(length, FELICA_CMD_READ_WITHOUT_ENCRYPTION + 1))
+        return false;
+    if (packetbuffer[3] < 16 + count * 16 || packetbuffer[18] != 0x00 || packetbuffer[20] != count)
+        return false;
+    
+    *data = packetbuffer + 21;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Sends the FeliCa command at packetbuffer[2] to the active target with
+ InDataExchange, the response replaces it from packetbuffer[8]
+ 
+ @param  length        command length, including its length byte
+ @param  responseCode  the response code expected, command code + 1
+ 
+ @returns true if the PN532 reports success and the target answered with
+ responseCode and its IDm
+ */
+/**************************************************************************/
+boolean Mifare::felica_exchange (uint8_t length, uint8_t responseCode){
+    packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
+    packetbuffer[1] = target->tg;
+    
+    if (! board->sendCommandCheckAck(packetbuffer, length + 2))
+        return false;
+    
+    uint8_t frame = frameSize();
+    board->readdata(packetbuffer, frame);
+    
+#ifdef MIFAREDEBUG
+    Serial.print("FeliCa ");
+    for(uint8_t i=0;i<22;i++) {
+        Serial.print(packetbuffer[i], HEX); Serial.print(" ");
+    }
+    Serial.println("");
+#endif
+    
+    if ((packetbuffer[6] != 0x41) || ((packetbuffer[7] & 0x3F) != 0x00))
+        return false;
+    if (packetbuffer[3] < 13 || packetbuffer[3] + 7 > frame)
+        return false;
+    
+    return (packetbuffer[9] == responseCode) && (memcmp(packetbuffer + 10, target->uid, 8) == 0);
+}
+
+
+/*
+ blocks in a Read Without Encryption response frame: header, status,
+ length, code, IDm, status flags, block count, checksum and postamble take
+ 23 bytes. 0 when the transport can't read a single block.
+ */
+uint8_t Mifare::felica_maxBlocks (){
+    return (frameSize() - 23) / 16;
+}
+
+
+/*
+ streams a mifare ultralight payload
+ checks the capability container in page 3 for the size of the data area
+ which starts on page 4
+ */
+boolean Mifare::ultralight_streamPayload (MIFARE_BLOCK_CALLBACK callback, void * context){
+    if (!ultralight_readCapabilityContainer())
+        return false;
+    
+    return streamMessageTLV(callback, context);
+}
+
+
+/*
+ reads the capability container in page 3 and sets the size of the data area
+ returns false if the tag isn't formatted for NDEF
+ */
+boolean Mifare::ultralight_readCapabilityContainer (){
+    uint8_t cc[4];
+    
+    for (uint8_t attempt = 0; !ultralight_readMemoryBlock(3, cc); attempt++){
+        if (!recover(attempt))
+            return false;
+    }
+    if (cc[0] != NDEF_CC_MAGIC)
+        return false;
+    
+    // byte 2 holds the size of the data area divided by 8
+    dataSize = cc[2] * 8;
+    return true;
+}
+
+
+/*
+ size of a data block as the data area is read, classic blocks are 16
+ bytes, on ultralight it's the 4 pages returned by a READ
+ */
+uint8_t Mifare::blockSize (){
+    return 16;
+}
+
+
+/*
+ longest response read into packetbuffer: its size, or less when the
+ transport reads shorter frames (30 bytes over I2C with the AVR Wire buffer)
+ */
+uint8_t Mifare::frameSize (){
+    uint8_t limit = board->responselimit();
+    return (limit < MIFARE_PACKBUFFSIZE) ? limit : MIFARE_PACKBUFFSIZE;
+}
+
+
+/*
+ maps the index of a data block to its address on a classic card, walking
+ the NDEF sectors of the session's sector map
+ sectors 1..31 hold 3 data blocks, sectors 32..39 (4K) hold 15
+ returns 0 past the last NDEF sector
+ */
+uint8_t Mifare::classic_dataBlock (uint8_t index){
+    for (uint8_t sector = 1; sector < 40; sector++){
+        if (!(session->sectors[sector >> 3] & (1 << (sector & 7))))
+            continue;
+        
+        uint8_t blocks = (sector < 32) ? 3 : 15;
+        if (index < blocks)
+            return (sector < 32) ? sector * 4 + index : 128 + (sector - 32) * 16 + index;
+        index -= blocks;
+    }
+    return 0;
+}
+
+
+/*
+ address of the sector footer (trailer) of the sector holding blockaddress
+ */
+uint8_t Mifare::classic_trailerBlock (uint8_t blockaddress){
+    return (blockaddress < 128) ? (blockaddress | 0x03) : (blockaddress | 0x0F);
+}
+
+
+/*
+ reads the data block at index (0 is the first block of the NDEF data area)
+ classic: the blocks of the NDEF sectors skipping the sector footers,
+ ultralight: pages 4 + 4 * index to 7 + 4 * index
+ */
+boolean Mifare::readDataBlock (uint8_t index, uint8_t * block){
+    for (uint8_t attempt = 0; ; attempt++){
+        if (requestDataBlock(index) && collectDataBlock(block))
+            return true;
+        if ((uint16_t)index * 16 >= dataSize || !recover(attempt))
+            return false;
+    }
+}
+
+
+/*
+ first half of readDataBlock, authenticates if needed and sends the READ
+ without waiting for the card. the PN532 works on it until
+ collectDataBlock, the host is free in between.
+ */
+boolean Mifare::requestDataBlock (uint8_t index){
+    uint8_t blockaddress;
+    
+    // the last block may be partly past the data area on ultralight
+    if ((uint16_t)index * 16 >= dataSize)
+        return false;
+    
+    if (cardType == MIFARE_ULTRALIGHT){
+        blockaddress = 4 + index * 4;
+    }else{
+        blockaddress = classic_dataBlock(index);
+        if (!classic_authenticateBlock(blockaddress))
+            return false;
+    }
+    
+    packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
+    packetbuffer[1] = target->tg;
+    packetbuffer[2] = MIFARE_CMD_READ;
+    packetbuffer[3] = blockaddress;
+    
+    return board->sendCommandAck(packetbuffer, 4);
+}
+
+
+/*
+ second half of readDataBlock, waits for the READ response and copies the
+ 16 bytes to block
+ */
+boolean Mifare::collectDataBlock (uint8_t * block){
+    if (!board->waitready())
+        return false;
+    
+    board->readdata(packetbuffer, 26);
+    
+    if ((packetbuffer[6] != 0x41) || (packetbuffer[7] != 0x00)){
+        forgetAuthentication();
+        return false;
+    }
+    memcpy(block, packetbuffer + 8, 16);
+    return true;
+}
+
+
+/*
+ returns the byte at position in the data area, false past its end
+ block holds the last block read and loaded its index, a new block is only
+ read from the card when position moves past it
+ */
+boolean Mifare::readDataByte (uint16_t position, uint8_t * block, uint8_t * loaded, uint8_t * value){
+    uint8_t size = blockSize();
+    uint8_t index = position / size;
+    
+    if (position >= dataSize)
+        return false;
+    if (index != *loaded){
+        if (!readDataBlock(index, block))
+            return false;
+        *loaded = index;
+    }
+    *value = block[position % size];
+    return true;
+}
+
+
+/*
+ walks the TLV blocks of the data area until it finds the NDEF message TLV,
+ then reads only the blocks holding the message and passes them to callback,
+ each block requested before the callback runs on the previous one
+ */
+boolean Mifare::streamMessageTLV (MIFARE_BLOCK_CALLBACK callback, void * context){
+    uint8_t block_buffer[16];
+    uint8_t size = blockSize();
+    uint8_t loaded = 0xFF;
+    uint16_t position = 0;
+    uint8_t tag, value;
+    uint16_t length;
+    
+    while (true) {
+        if (!readDataByte(position++, block_buffer, &loaded, &tag))
+            return false;
+        if (tag == NDEF_TLV_NULL)
+            continue;
+        if (tag == NDEF_TLV_TERMINATOR)
+            return false;
+        
+        // 1 byte length, or 0xFF followed by a 2 byte length
+        if (!readDataByte(position++, block_buffer, &loaded, &value))
+            return false;
+        length = value;
+        if (value == NDEF_TLV_LONG_LENGTH){
+            if (!readDataByte(position++, block_buffer, &loaded, &value))
+                return false;
+            length = value << 8;
+            if (!readDataByte(position++, block_buffer, &loaded, &value))
+                return false;
+            length |= value;
+        }
+        
+        if (tag == NDEF_TLV_MESSAGE)
+            break;
+        
+        // lock control, memory control and proprietary TLVs are skipped
+        if (position + length > dataSize)
+            return false;
+        position += length;
+    }
+    
+#ifdef MIFAREDEBUG
+    Serial.print("NDEF message length: "); Serial.println(length, DEC);
+#endif
+    if (position + length > dataSize)
+        return false;
+    if (length == 0)
+        return callback(block_buffer, 0, 0, 0, context);
+    
+    // the READ of the next block is sent before the callback works on the
+    // current one, and collected after, so the host works during the RF exchange
+    uint8_t next_buffer[16];
+    uint8_t * current = block_buffer;
+    uint8_t * next = next_buffer;
+    uint8_t last = (position + length - 1) / size;
+    uint16_t offset = 0;
+    
+    if (position / size != loaded){
+        if (!readDataBlock(position / size, block_buffer))
+            return false;
+        loaded = position / size;
+    }
+    
+    while (offset < length) {
+        uint8_t start = position % size;
+        uint8_t chunk = size - start;
+        if (chunk > length - offset)
+            chunk = length - offset;
+        
+        boolean more = (loaded < last);
+        boolean requested = more && requestDataBlock(loaded + 1);
+        
+        boolean keepGoing = callback(current + start, chunk, offset, length, context);
+        
+        // the response has to be read even when the callback stops, a block
+        // that failed is read again with recovery
+        if (requested && !collectDataBlock(next))
+            requested = false;
+        if (!keepGoing)
+            return false;
+        if (more && !requested && !readDataBlock(loaded + 1, next))
+            return false;
+        
+        uint8_t * swap = current;
+        current = next;
+        next = swap;
+        loaded++;
+        
+        offset += chunk;
+        position += chunk;
+    }
+    return true;
+}
+
+
+/* write payload */
+
+//uses the active target, or detects one when there is none
+//get type of card and write the payload using either classic or ultralight
+//assumes payload is pre-formated with its own header
+
+boolean Mifare::writePayload (uint8_t *payload, uint16_t length){
+    if (!session && !detect())
+        return false;
+    
+    // the tag may have left the field, detect again next time
+    if (!writePayload(session, payload, length)){
+        session = 0;
+        target = 0;
+        return false;
+    }
+    return true;
+}
+
+/*
+ writes the payload to the session's target, a block that fails is written
+ again after selecting the target like streamPayload
+ */
+boolean Mifare::writePayload (MIFARE_SESSION * s, uint8_t *payload, uint16_t length){
+    if (!activate(s))
+        return false;
+    return write(payload, length);
+}
+
+boolean Mifare::write (uint8_t *payload, uint16_t length){
+    memset(&verifyReport, 0, sizeof(verifyReport));
+    
+    switch (cardType) {
+        case MIFARE_CLASSIC:
+        case MIFARE_CLASSIC_4K:
+            // the MAD is read once per session, and only written when there is no NDEF in it
+            if (!session->mapped && !classic_readDirectory())
+                return false;
+            if (!session->formatted && !classic_formatForNDEF(length))
+                return false;
+            dataSize = classic_mapSize();
+            return classic_writePayload(payload, length);
+            break;
+        case MIFARE_ULTRALIGHT:
+            // tags without a capability container get the plain ultralight size
+            if (!ultralight_readCapabilityContainer())
+                dataSize = ULTRALIGHT_DATA_SIZE;
+            return ultralight_writePayload(payload, length);
+            break;
+        default:
+            return false;
+            break;
+    }
+}
+
+/*
+ writes a payload to a mifare classic
+ starts in block 4
+ blocks are 16 bytes long
+ every sector is closed with a pre-defined sector footer which contains the keys
+ the rest of the last sector is filled with zeros
+ */
+boolean Mifare::classic_writePayload (uint8_t *payload, uint16_t len){
+    uint8_t foot[16] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    
+    memcpy(foot, keyA, 6);
+    memcpy(foot+10, keyB, 6);
+    
+    uint8_t block_buffer[16];
+    uint16_t position = 0;
+    uint8_t index = 0;
+    
+    if (len > dataSize)
+        return false;
+    
+    while (true) {
+        uint8_t block = classic_dataBlock(index++);
+        uint16_t chunk = (len - position < 16) ? len - position : 16;
+        
+        memset(block_buffer, 0, 16);
+        memcpy(block_buffer, payload + position, chunk);
+        position += chunk;
+        
+        if (!classic_updateMemoryBlock(block, block_buffer))
+            return false;
+        
+        if (block + 1 == classic_trailerBlock(block)){
+            //close sector with footer block
+            if (!classic_updateMemoryBlock(block + 1, foot))
+                return false;
+            if (position == len)
+                break;
+        }
+    }
+    
+    return true;
+}
+/*
+ writes a payload to a mifare ultralight
+ starts on page 4 (using 'block' instead of 'page' for consistency in variable naming)
+ writes until the end of the payload, no footer or anything needed here. 
+ */
+
+boolean Mifare::ultralight_writePayload (uint8_t *payload, uint16_t len){
+    uint8_t block_buffer[16];
+    uint16_t position = 0;
+    uint8_t block_count = 4;
+    
+    if (len > dataSize)
+        return false;
+    
+    // four pages at a time, the size of a READ when comparing
+    while (position < len){
+        uint16_t chunk = (len - position < 16) ? len - position : 16;
+        uint8_t pages = (chunk + 3) / 4;
+        
+        memset(block_buffer, 0, 16);
+        memcpy(block_buffer, payload + position, chunk);
+        position += chunk;
+        
+        if (!ultralight_updatePages(block_count, block_buffer, pages))
+            return false;
+        block_count += pages;
+    }
+   
+    return true;
+}
+
+/* provisioning */
+
+/**************************************************************************/
+/*!
+ Prepares provision, which writes the same payload to tag after tag. The
+ payload is the TLV from NDEF::encode_URI, encode_TEXT or encode_MIME,
+ encoded once and kept by the caller. The block writes are built the first
+ time a card type is provisioned and run with execute on every tag of
+ that type, straight from the payload: no copy of the message per tag, one
+ authentication per classic sector.
+ 
+ @param  provision  ops, size and verify set by the caller, the rest is
+ filled in
+ @param  payload    the message TLV
+ @param  length     its length
+ 
+ @returns false if payload isn't an NDEF message TLV
+ */
+/**************************************************************************/
+boolean Mifare::prepareProvisioning (MIFARE_PROVISION * provision, uint8_t * payload, uint16_t length){
+    if (length < 2 || payload[0] != NDEF_TLV_MESSAGE)
+        return false;
+    
+    provision->payload = payload;
+    provision->length = length;
+    provision->count = 0;
+    provision->type = 0;
+    provision->tags = 0;
+    provision->failures = 0;
+    provision->start = millis();
+    provision->time = 0;
+    provision->rate = 0;
+    
+    // the sector footer classic_writePayload closes every sector with
+    memcpy(provision->trailer, madTrailer, 16);
+    memcpy(provision->trailer, keyA, 6);
+    memcpy(provision->trailer + 10, keyB, 6);
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Waits for a tag, writes the prepared payload to it and, with verify set,
+ reads the message back and compares it. The tag is then released, which
+ halts it: it stays quiet until it leaves the field, so the next call
+ waits for a new tag. Classic cards without a MAD are formatted first,
+ cards whose MAD gives NDEF other sectors are written like writePayload.
+ 
+ tags, failures, time and rate are updated after every tag. rate is the
+ tags written per minute since prepareProvisioning, operator time
+ included, time only counts the ms spent on the tags.
+ 
+ @param  provision  prepared by prepareProvisioning
+ @param  timeout    ms to wait for a tag, 0 waits forever
+ 
+ @returns true if a tag was written (and verified). false if it failed, or
+ if no tag came within timeout (failures doesn't change)
+ */
+/**************************************************************************/
+boolean Mifare::provision (MIFARE_PROVISION * provision, uint16_t timeout){
+    MIFARE_SESSION * s = detect(timeout);
+    
+    if (!s)
+        return false;
+    
+    unsigned long begin = millis();
+    boolean written = provisionTarget(provision);
+    
+    release(s);
+    provision->time += millis() - begin;
+    if (written)
+        provision->tags++;
+    else
+        provision->failures++;
+    
+    unsigned long elapsed = millis() - provision->start;
+    provision->rate = elapsed ? (uint32_t)provision->tags * 60000 / elapsed : 0;
+    return written;
+}
+
+
+/*
+ block callback used to verify a provisioned tag, compares every chunk of
+ the message read back with the payload
+ */
+static boolean comparePayloadChunk (uint8_t * data, uint8_t length, uint16_t offset, uint16_t total, void * context){
+    MIFARE_PROVISION * provision = (MIFARE_PROVISION *)context;
+    boolean longLength = (provision->payload[1] == NDEF_TLV_LONG_LENGTH);
+    uint8_t header = longLength ? 4 : 2;
+    uint16_t size = longLength ? ((uint16_t)provision->payload[2] << 8) | provision->payload[3] : provision->payload[1];
+    
+    if (total != size || header + offset + length > provision->length)
+        return false;
+    return memcmp(provision->payload + header + offset, data, length) == 0;
+}
+
+
+/*
+ writes the prepared payload to the active target, the ops are built again
+ when the card type changes
+ */
+boolean Mifare::provisionTarget (MIFARE_PROVISION * provision){
+    uint8_t sectors[MIFARE_SECTOR_MAP_SIZE];
+    boolean prepared = true;
+    boolean written;
+    
+    switch (cardType) {
+        case MIFARE_CLASSIC:
+        case MIFARE_CLASSIC_4K:
+            if (!session->mapped && !classic_readDirectory())
+                return false;
+            if (!session->formatted && !classic_formatForNDEF(provision->length))
+                return false;
+            
+            // the ops are laid out for every sector, what classic_formatForNDEF gives NDEF
+            memcpy(sectors, session->sectors, MIFARE_SECTOR_MAP_SIZE);
+            classic_mapAllSectors();
+            if (memcmp(sectors, session->sectors, MIFARE_SECTOR_MAP_SIZE) != 0){
+                memcpy(session->sectors, sectors, MIFARE_SECTOR_MAP_SIZE);
+                prepared = false;
+            }
+            dataSize = classic_mapSize();
+            break;
+        case MIFARE_ULTRALIGHT:
+            if (!ultralight_readCapabilityContainer())
+                dataSize = ULTRALIGHT_DATA_SIZE;
+            break;
+        default:
+            return false;
+            break;
+    }
+    
+    if (provision->length > dataSize)
+        return false;
+    if (!prepared)
+        written = classic_writePayload(provision->payload, provision->length);
+    else if (provision->type != cardType && !prepareOperations(provision))
+        written = false;
+    else
+        written = execute(session, provision->ops, provision->count);
+    
+    if (!written || !provision->verify)
+        return written;
+    return stream(comparePayloadChunk, provision);
+}
+
+
+/*
+ builds the writes of the payload for the active target's card type:
+ ultralight pages from 4, or classic data blocks in the NDEF sectors, each
+ sector closed with its footer. the rest of the last sector isn't cleared,
+ the terminator TLV ends the message. the last page or block is written
+ from the zero padded tail, the others straight from the payload.
+ */
+boolean Mifare::prepareOperations (MIFARE_PROVISION * provision){
+    boolean ultralight = (cardType == MIFARE_ULTRALIGHT);
+    uint8_t unit = ultralight ? 4 : 16;
+    uint16_t full = provision->length / unit;
+    uint16_t blocks = (provision->length + unit - 1) / unit;
+    uint8_t count = 0;
+    
+    provision->type = 0;
+    memset(provision->tail, 0, 16);
+    memcpy(provision->tail, provision->payload + full * unit, provision->length - full * unit);
+    
+    for (uint16_t i = 0; i < blocks; i++){
+        uint8_t address = ultralight ? 4 + i : classic_dataBlock(i);
+        boolean closing = !ultralight && (address + 1 == classic_trailerBlock(address) || i + 1 == blocks);
+        
+        if (count + (closing ? 2 : 1) > provision->size)
+            return false;
+        
+        provision->ops[count].operation = MIFARE_OP_WRITE;
+        provision->ops[count].blockaddress = address;
+        provision->ops[count].data = (i < full) ? provision->payload + i * unit : provision->tail;
+        count++;
+        
+        if (closing){
+            provision->ops[count].operation = MIFARE_OP_WRITE;
+            provision->ops[count].blockaddress = classic_trailerBlock(address);
+            provision->ops[count].data = provision->trailer;
+            count++;
+        }
+    }
+    
+    provision->count = count;
+    provision->type = cardType;
+    return true;
+}
+
+/* card images */
+
+/*
+ the header of an image of the active target, the memory follows it
+ */
+static void imageHeader (uint8_t * header, uint16_t size){
+    uint8_t uidLength = (target->uidLength > 7) ? 7 : target->uidLength;
+    
+    memset(header, 0, MIFARE_IMAGE_HEADER);
+    header[0] = MIFARE_IMAGE_VERSION;
+    header[1] = Mifare::cardType >> 16;
+    header[2] = Mifare::cardType >> 8;
+    header[3] = Mifare::cardType;
+    header[4] = size >> 8;
+    header[5] = size;
+    header[6] = uidLength;
+    memcpy(header + 7, target->uid, uidLength);
+}
+
+
+/**************************************************************************/
+/*!
+ Reads the whole memory of a classic or ultralight family tag into an
+ image, handed to callback as it is read: the MIFARE_IMAGE_HEADER bytes
+ of the header, then the memory in block or page order.
+ 
+ Classic: every block with the sector trailers, one authentication per
+ sector (the key dictionary is used if set). Key A never reads back and
+ key B only with some access bits, so the image's trailer gets the key
+ that opened the sector. When the other key reads as zeros, keyA or keyB
+ is tried for it with one more authentication, if it fails the image
+ keeps the zeros: fill the key in before restoring the image.
+ 
+ Ultralight and NTAG: pages from 0 to the dynamic lock bytes, and on
+ ultralight EV1 and NTAG21x the configuration pages (the password and
+ PACK read as zeros). These two are read with FAST_READ,
+ MIFARE_FAST_READ_PAGES pages at a time (5 over I2C on AVR), the others
+ with READ, 4 pages at a time.
+ 
+ @returns false if a block can't be read or callback stops
+ */
+/**************************************************************************/
+boolean Mifare::dump (MIFARE_SESSION * s, MIFARE_IMAGE_CALLBACK callback, void * context){
+    if (!activate(s))
+        return false;
+    
+    switch (cardType) {
+        case MIFARE_CLASSIC:
+        case MIFARE_CLASSIC_4K:
+            return classic_dump(callback, context);
+            break;
+        case MIFARE_ULTRALIGHT:
+            return ultralight_dump(callback, context);
+            break;
+        default:
+            return false;
+            break;
+    }
+}
+
+
+/**************************************************************************/
+/*!
+ Writes an image made by dump back to a tag of the same type, not
+ necessarily the same one. callback fills in the parts of the image asked
+ for. Every block and page is read first and only the ones that differ
+ are written, in an order that keeps the tag usable if it leaves the
+ field halfway:
+ 
+ Classic: sector by sector, the data blocks before the trailer, so the
+ keys change last. Block 0 is the manufacturer block and is skipped.
+ 
+ Ultralight and NTAG: the capability container and the data area, then
+ the dynamic lock bytes, then the static lock bytes in page 2. The UID
+ pages and the configuration pages are skipped.
+ 
+ setVerify applies like for writePayload.
+ 
+ @returns false if the image is for another card type or size, or a write
+ fails
+ */
+/**************************************************************************/
+boolean Mifare::restore (MIFARE_SESSION * s, MIFARE_IMAGE_CALLBACK callback, void * context){
+    uint8_t header[MIFARE_IMAGE_HEADER];
+    uint8_t mode = writeMode;
+    boolean restored;
+    
+    if (!activate(s))
+        return false;
+    if (!callback(header, MIFARE_IMAGE_HEADER, 0, context) || header[0] != MIFARE_IMAGE_VERSION)
+        return false;
+    if ((((uint32_t)header[1] << 16) | ((uint16_t)header[2] << 8) | header[3]) != cardType)
+        return false;
+    
+    uint16_t size = ((uint16_t)header[4] << 8) | header[5];
+    
+    // the diffing is the differential write mode
+    writeMode = MIFARE_WRITE_DIFFERENTIAL;
+    memset(&verifyReport, 0, sizeof(verifyReport));
+    
+    switch (cardType) {
+        case MIFARE_CLASSIC:
+        case MIFARE_CLASSIC_4K:
+            restored = classic_restore(size, callback, context);
+            break;
+        case MIFARE_ULTRALIGHT:
+            restored = ultralight_restore(size, callback, context);
+            break;
+        default:
+            restored = false;
+            break;
+    }
+    
+    writeMode = mode;
+    return restored;
+}
+
+
+static const uint8_t zeroKey[6] = {0, 0, 0, 0, 0, 0};
+
+/*
+ dumps a classic card block by block, classic_readMemoryBlock authenticates
+ once per sector
+ */
+boolean Mifare::classic_dump (MIFARE_IMAGE_CALLBACK callback, void * context){
+    uint16_t blocks = (cardType == MIFARE_CLASSIC_4K) ? 256 : 64;
+    uint8_t header[MIFARE_IMAGE_HEADER];
+    uint8_t block[16];
+    uint8_t keyType;
+    
+    imageHeader(header, blocks * 16);
+    if (!callback(header, MIFARE_IMAGE_HEADER, 0, context))
+        return false;
+    
+    for (uint16_t b = 0; b < blocks; b++){
+        for (uint8_t attempt = 0; !classic_readMemoryBlock(b, block); attempt++){
+            if (!recover(attempt))
+                return false;
+        }
+        if (classic_trailerBlock(b) == b){
+            const uint8_t * key = classic_sectorKey(classicSector(b), &keyType);
+            uint8_t * hidden = block + ((keyType == KEY_A) ? 10 : 0);
+            
+            memcpy(block + ((keyType == KEY_A) ? 0 : 10), key, 6);
+            
+            // the other key read as zeros, keyA or keyB may be it. the sector is done, the extra authentication costs nothing else
+            if (memcmp(hidden, zeroKey, 6) == 0){
+                const uint8_t * guess = (keyType == KEY_A) ? keyB : keyA;
+                
+                if (classic_authenticate(b, (keyType == KEY_A) ? KEY_B : KEY_A, guess))
+                    memcpy(hidden, guess, 6);
+                else if (!targetCommand(PN532_COMMAND_INSELECT, target->tg))
+                    return false;
+                forgetAuthentication();
+            }
+        }
+        if (!callback(block, 16, MIFARE_IMAGE_HEADER + b * 16, context))
+            return false;
+    }
+    return true;
+}
+
+
+/*
+ restores a classic card in block order, which puts every trailer after
+ the data blocks of its sector
+ */
+boolean Mifare::classic_restore (uint16_t size, MIFARE_IMAGE_CALLBACK callback, void * context){
+    uint16_t blocks = (cardType == MIFARE_CLASSIC_4K) ? 256 : 64;
+    uint8_t block[16];
+    
+    if (size != blocks * 16)
+        return false;
+    
+    for (uint16_t b = 1; b < blocks; b++){
+        if (!callback(block, 16, MIFARE_IMAGE_HEADER + b * 16, context))
+            return false;
+        if (!classic_updateMemoryBlock(b, block))
+            return false;
+    }
+    return true;
+}
+
+
+/*
+ dumps an ultralight family tag, with FAST_READ when the tag has it
+ */
+boolean Mifare::ultralight_dump (MIFARE_IMAGE_CALLBACK callback, void * context){
+    uint8_t header[MIFARE_IMAGE_HEADER];
+    uint8_t block[16];
+    uint8_t pages, dataEnd, lockPage;
+    boolean fastRead;
+    
+    if (!ultralight_readLayout(&pages, &dataEnd, &lockPage, &fastRead))
+        return false;
+    
+    imageHeader(header, pages * 4);
+    if (!callback(header, MIFARE_IMAGE_HEADER, 0, context))
+        return false;
+    
+    for (uint8_t page = 0; page < pages; ){
+        uint8_t count = fastRead ? (frameSize() - 10) / 4 : 4;
+        uint8_t * data = block;
+        
+        if (pages - page < count)
+            count = pages - page;
+        for (uint8_t attempt = 0; ; attempt++){
+            if (fastRead ? ultralight_fastRead(page, page + count - 1, &data) : ultralight_readPages(page, block))
+                break;
+            if (!recover(attempt))
+                return false;
+        }
+        if (!callback(data, count * 4, MIFARE_IMAGE_HEADER + page * 4, context))
+            return false;
+        page += count;
+    }
+    return true;
+}
+
+
+/*
+ restores an ultralight family tag: pages 3 to dataEnd four at a time, then
+ the lock bytes
+ */
+boolean Mifare::ultralight_restore (uint16_t size, MIFARE_IMAGE_CALLBACK callback, void * context){
+    uint8_t block[16];
+    uint8_t pages, dataEnd, lockPage;
+    boolean fastRead;
+    
+    if (!ultralight_readLayout(&pages, &dataEnd, &lockPage, &fastRead) || size != pages * 4)
+        return false;
+    
+    for (uint8_t page = 3; page < dataEnd; page += 4){
+        uint8_t count = (dataEnd - page < 4) ? dataEnd - page : 4;
+        
+        if (!callback(block, count * 4, MIFARE_IMAGE_HEADER + page * 4, context))
+            return false;
+        if (!ultralight_updatePages(page, block, count))
+            return false;
+    }
+    
+    if (lockPage){
+        if (!callback(block, 4, MIFARE_IMAGE_HEADER + lockPage * 4, context))
+            return false;
+        if (!ultralight_updatePages(lockPage, block, 1))
+            return false;
+    }
+    
+    if (!callback(block, 4, MIFARE_IMAGE_HEADER + 2 * 4, context))
+        return false;
+    return ultralight_updatePages(2, block, 1);
+}
+
+
+/*
+ GET_VERSION storage size and the number of pages of ultralight EV1 and
+ NTAG21x tags
+ */
+static const uint8_t ultralightSizes[][2] = {{0x0B, 20}, {0x0E, 41}, {0x0F, 45}, {0x11, 135}, {0x13, 231}};
+
+/*
+ finds the pages of the active ultralight family tag. GET_VERSION knows
+ ultralight EV1 and NTAG21x: their last 4 pages are the configuration,
+ password and PACK, tags above 20 pages have the dynamic lock bytes before
+ them, and FAST_READ works. GET_VERSION goes as a raw frame with
+ InCommunicateThru, InDataExchange would take its code for a classic
+ AUTH_A. ultralight and ultralight C answer GET_VERSION with an error (or
+ not at all) and are selected again, their data area comes from the
+ capability container (a blank one is taken for an ultralight) and is
+ followed by the lock bytes when it's larger than 48 bytes.
+ dataEnd is the page after the data area, lockPage the page of the
+ dynamic lock bytes, 0 for none
+ */
+boolean Mifare::ultralight_readLayout (uint8_t * pages, uint8_t * dataEnd, uint8_t * lockPage, boolean * fastRead){
+    // InCommunicateThru talks to the target the PN532 selected last
+    if (targetCount > 1 && !targetCommand(PN532_COMMAND_INSELECT, target->tg))
+        return false;
+    
+    packetbuffer[0] = PN532_COMMAND_INCOMMUNICATETHRU;
+    packetbuffer[1] = MIFARE_CMD_GET_VERSION;
+    
+    if (! board->sendCommandCheckAck(packetbuffer, 2))
+        return false;
+    board->readdata(packetbuffer, 18);
+    
+    *pages = 0;
+    if ((packetbuffer[6] == PN532_COMMAND_INCOMMUNICATETHRU + 1) && ((packetbuffer[7] & 0x3F) == 0x00) && packetbuffer[3] == 11){
+        // vendor, product type, subtype, major and minor version, storage size, protocol
+        for (uint8_t i = 0; i < sizeof(ultralightSizes) / 2; i++){
+            if (ultralightSizes[i][0] == packetbuffer[14])
+                *pages = ultralightSizes[i][1];
+        }
+    }else if (!targetCommand(PN532_COMMAND_INSELECT, target->tg)){
+        return false;
+    }
+    
+    *fastRead = (*pages > 0);
+    if (*pages > 0){
+        *lockPage = (*pages > 20) ? *pages - 5 : 0;
+        *dataEnd = *lockPage ? *lockPage : *pages - 4;
+        return true;
+    }
+    
+    if (!ultralight_readCapabilityContainer())
+        dataSize = 48;
+    *dataEnd = 4 + dataSize / 4;
+    *lockPage = (dataSize > 48) ? *dataEnd : 0;
+    *pages = *dataEnd + (*lockPage ? 1 : 0);
+    return true;
+}
+
+
+/*
+ FAST_READ of pages first to last, at most (frameSize() - 10) / 4. data is
+ set to the pages in packetbuffer, valid until the next command
+ */
+boolean Mifare::ultralight_fastRead (uint8_t first, uint8_t last, uint8_t ** data){
+    uint8_t length = (last - first + 1) * 4;
+    
+    packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
+    packetbuffer[1] = target->tg;
+    packetbuffer[2] = NTAG_CMD_FAST_READ;
+    packetbuffer[3] = first;
+    packetbuffer[4] = last;
+    
+    if (! board->sendCommandCheckAck(packetbuffer, 5))
+        return false;
+    
+    board->readdata(packetbuffer, 8 + length + 2);
+    if ((packetbuffer[6] != 0x41) || ((packetbuffer[7] & 0x3F) != 0x00) || packetbuffer[3] != 3 + length)
+        return false;
+    
+    *data = packetbuffer + 8;
+    return true;
+}
+
+
+
+
+/**************************************************************************/
+/*!
+ Authenticates the sector of a block. Without a key dictionary it uses
+ keyA or keyB as picked by useKey. With a dictionary it first tries the key
+ that worked last time for this card and sector, then walks the other
+ keys, selecting the card again after every failure (a failed
+ authentication drops the card out of the selected state). The key that
+ works is remembered for the card and sector. Nothing is sent while the
+ sector is still authenticated from the previous operation.
+ 
+ @param  blockNumber   The block number to authenticate.  (0..63 for
+ 1KB cards, and 0..255 for 4KB cards).
+ 
+ @returns true if everything executed properly, false for an error
  */
-boolean Mifare::classic_writePayload (uint8_t *payload, uint8_t len){
-    const uint8_t zero[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-    uint8_t foot[16] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+/**************************************************************************/
+boolean Mifare::classic_authenticateBlock (uint32_t blockNumber){
+    uint8_t sector = classicSector(blockNumber);
     
-    memcpy(foot, keyA, 6);
-    memcpy(foot+10, keyB, 6);
+    // still authenticated from the last operation on this sector
+    if (authTarget == target && authSector == sector)
+        return true;
     
-    uint8_t block_buffer[16] = {};
-    uint8_t start_block = 4;
+    if (keyDictionarySize == 0){
+        if (!classic_authenticate(blockNumber, useKey, (useKey == KEY_A) ? keyA : keyB))
+            return false;
+        authTarget = target;
+        authSector = sector;
+        return true;
+    }
     
-    uint8_t position = 0;
-    uint8_t block_count = start_block;
-    uint8_t byte_count = 0;
+    MIFARE_KEYHIT * hit = 0;
+    uint8_t first = 0xFF;
     
-    //add 2 zeros to the front of the payload who knows why
-    memmove(payload +2, payload, len);
-    memcpy(payload, zero, 2);
-    len +=2;
+    for (uint8_t i = 0; i < MIFARE_KEYHITS; i++){
+        if (keyHits[i].sector == sector && memcmp(keyHits[i].uid, target->uid, 4) == 0){
+            hit = &keyHits[i];
+            first = hit->key;
+            break;
+        }
+    }
     
+    if (first < keyDictionarySize){
+        if (classic_authenticate(blockNumber, keyDictionary[first].type, keyDictionary[first].key)){
+            authTarget = target;
+            authSector = sector;
+            return true;
+        }
+        if (!targetCommand(PN532_COMMAND_INSELECT, target->tg))
+            return false;
+    }
     
-    while (position < len){
-        if (block_count %4 < 3) {
-            //copy payload byte into buffer position
-            memcpy (block_buffer+byte_count, payload+position, 1);
-            
-            byte_count ++;
-            position ++;
-            
-            if (byte_count == 16 ) {
-                //end of block
-                byte_count = 0;
-                
-                // write block
-                if (!classic_writeMemoryBlock(block_count, block_buffer))
-                    return false;
-                
-                //reset
-                memcpy(block_buffer, zero, 16);
-                block_count ++;
+    for (uint8_t k = 0; k < keyDictionarySize; k++){
+        if (k == first)
+            continue;
+        if (classic_authenticate(blockNumber, keyDictionary[k].type, keyDictionary[k].key)){
+            if (!hit){
+                hit = &keyHits[keyHitNext];
+                keyHitNext = (keyHitNext + 1) % MIFARE_KEYHITS;
+                memcpy(hit->uid, target->uid, 4);
+                hit->sector = sector;
             }
-            
-        }else if (block_count %4 == 3) {
-            //close sector with footer block
-            memcpy(block_buffer, foot, 16);
-            if (!classic_writeMemoryBlock(block_count, block_buffer))
-                return false;
-            memcpy(block_buffer, zero, 16);
-            block_count ++;
-            byte_count = 0;
+            hit->key = k;
+            authTarget = target;
+            authSector = sector;
+            return true;
         }
-    }
-    //write any remaining buffer
-    if (byte_count > 0){
-        if (!classic_writeMemoryBlock(block_count, block_buffer))
+        if (!targetCommand(PN532_COMMAND_INSELECT, target->tg))
             return false;
-        block_count ++;
     }
-    //fill any empty blocks in the sector
-    while (block_count %4 < 3) {
-        memcpy(block_buffer, zero, 16);
-        if (!classic_writeMemoryBlock(block_count, block_buffer))
-            return false;        block_count ++;
-    }
-
-    //write final footer block
-    memcpy(block_buffer, foot, 16);
-    if (!classic_writeMemoryBlock(block_count, block_buffer))
-        return false;
-    
-    return true;
+    return false;
 }
+
 /*
- writes a payload to a mifare ultralight
- starts on page 4 (using 'block' instead of 'page' for consistency in variable naming)
- writes until it fills the card, no footer or anything needed here. 
+ the key classic_authenticateBlock opened sector with on the active target
  */
-
-boolean Mifare::ultralight_writePayload (uint8_t *payload, uint8_t len){
-    const uint8_t zero[4] = {0x00, 0x00, 0x00, 0x00};
-    
-    uint8_t block_buffer[4] = {};
-    uint8_t start_block = 4;
-    
-    uint8_t position = 0;
-    uint8_t block_count = start_block;
-    uint8_t byte_count = 0;
-    
-    while (position < len){
-        memcpy (block_buffer+byte_count, payload+position, 1);
-            
-        byte_count ++;
-        position ++;
-        if (byte_count == 4 ) {
-            //end of block
-            byte_count = 0;
-                
-            // write block
-            if (!ultralight_writeMemoryBlock(block_count, block_buffer))
-                return false;
-                
-            //reset
-            memcpy(block_buffer, zero, 16);
-            block_count ++;
+const uint8_t * Mifare::classic_sectorKey (uint8_t sector, uint8_t * keyType){
+    for (uint8_t i = 0; keyDictionarySize > 0 && i < MIFARE_KEYHITS; i++){
+        if (keyHits[i].sector == sector && memcmp(keyHits[i].uid, target->uid, 4) == 0 && keyHits[i].key < keyDictionarySize){
+            *keyType = keyDictionary[keyHits[i].key].type;
+            return keyDictionary[keyHits[i].key].key;
         }
-
-    }
-    //write any remaining buffer
-    if (byte_count > 0){
-        if (!ultralight_writeMemoryBlock(block_count, block_buffer))
-            return false;
     }
-   
-    return true;
+    *keyType = useKey;
+    return (useKey == KEY_A) ? keyA : keyB;
 }
 
 
+
 /**************************************************************************/
 /*!
  Tries to authenticate a block of memory on a MIFARE card using the
@@ -393,34 +2826,32 @@ boolean Mifare::ultralight_writePayload (uint8_t *payload, uint8_t len){
  
  @param  blockNumber   The block number to authenticate.  (0..63 for
  1KB cards, and 0..255 for 4KB cards).
- @param  keyNumber     Which key type to use during authentication
- (0 = MIFARE_CMD_AUTH_A, 1 = MIFARE_CMD_AUTH_B)
+ @param  keyType       Which key type to use during authentication
+ (KEY_A or KEY_B)
  @param  keyData       Pointer to a byte array containing the 6 byte
  key value
  
  @returns true if everything executed properly, false for an error
  */
 /**************************************************************************/
-boolean Mifare::classic_authenticateBlock (uint32_t blockNumber){
+boolean Mifare::classic_authenticate (uint8_t blockNumber, uint8_t keyType, const uint8_t * keyData){
     
 #ifdef MIFAREDEBUG
     Serial.println("authenticating");
 #endif
    
+    forgetAuthentication();
+    
     // Prepare the authentication command //
     packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;   /* Data Exchange Header */
-    packetbuffer[1] = 1;                              /* Max card numbers */
-    packetbuffer[2] = (useKey == KEY_A) ? MIFARE_CMD_AUTH_A : MIFARE_CMD_AUTH_B;
+    packetbuffer[1] = target->tg;                     /* Card number */
+    packetbuffer[2] = (keyType == KEY_A) ? MIFARE_CMD_AUTH_A : MIFARE_CMD_AUTH_B;
     packetbuffer[3] = blockNumber;                    /* Block Number (1K = 0..63, 4K = 0..255 */
     
-    memcpy (packetbuffer+4, (useKey == KEY_A) ? keyA : keyB, 6);
-    for (uint8_t i = 0; i < uidLength; i++){
-        packetbuffer[10+i] = uid[i];                /* 4 byte card ID */
-    }
-    
-
+    memcpy (packetbuffer+4, keyData, 6);
+    memcpy (packetbuffer+10, target->uid, target->uidLength);   /* 4 byte card ID */
     
-    if (! board->sendCommandCheckAck(packetbuffer, 10+uidLength))
+    if (! board->sendCommandCheckAck(packetbuffer, 10+target->uidLength))
         return false;
     
     // Read the response packet
@@ -434,6 +2865,81 @@ boolean Mifare::classic_authenticateBlock (uint32_t blockNumber){
 }
 
 
+/**************************************************************************/
+/*!
+ Sets the keys tried to authenticate classic sectors, in order. Pass 0
+ keys to go back to keyA / keyB. The keys aren't copied, the array has to
+ stay around. Keys remembered for cards are forgotten.
+ 
+ @param  keys    the key dictionary
+ @param  count   number of keys
+ */
+/**************************************************************************/
+void Mifare::setKeyDictionary (const MIFARE_KEY * keys, uint8_t count){
+    keyDictionary = keys;
+    keyDictionarySize = count;
+    
+    for (uint8_t i = 0; i < MIFARE_KEYHITS; i++)
+        keyHits[i].key = 0xFF;
+    keyHitNext = 0;
+}
+
+
+/**************************************************************************/
+/*!
+ Picks how payloads and the NDEF format are written
+ 
+ MIFARE_WRITE_FULL writes every block and page. MIFARE_WRITE_DIFFERENTIAL
+ reads the tag first and writes only the blocks and pages that differ,
+ which is faster and spares the card for small updates, at the cost of
+ the reads when most of the content changes.
+ */
+/**************************************************************************/
+void Mifare::setWriteMode (uint8_t mode){
+    writeMode = mode;
+}
+
+
+/**************************************************************************/
+/*!
+ Sets how many times a failed block read or write of a payload is retried
+ after selecting the card again, 0 to give up on the first failure. value
+ block operations are never retried, they aren't idempotent.
+ */
+/**************************************************************************/
+void Mifare::setRetries (uint8_t count){
+    retries = count;
+}
+
+
+/**************************************************************************/
+/*!
+ Checks what writePayload writes, as it writes it. A classic block is read
+ back right after its WRITE, still authenticated; of a sector trailer only
+ the access bits can be read. Ultralight pages are checked four at a time,
+ the size of a READ. A block or page that reads back different is written
+ again, the others are left alone, within the retries of setRetries.
+ 
+ The READs are counted and timed apart from the writes, see
+ getVerifyReport.
+ */
+/**************************************************************************/
+void Mifare::setVerify (boolean verify){
+    verifyWrites = verify;
+}
+
+
+/**************************************************************************/
+/*!
+ @returns what verifying the last writePayload cost, zeros when verify is
+ off
+ */
+/**************************************************************************/
+MIFARE_VERIFY * Mifare::getVerifyReport (){
+    return &verifyReport;
+}
+
+
 /**************************************************************************/
 /*!
  Tries to read an entire 16-byte data block at the specified block
@@ -450,16 +2956,20 @@ boolean Mifare::classic_authenticateBlock (uint32_t blockNumber){
 boolean Mifare::classic_readMemoryBlock(uint8_t blockaddress, uint8_t * block) {
     
 //    Serial.print("blockaddress:");Serial.println(blockaddress, DEC);
-    if (blockaddress >= 64)
-        return false;
-    
     if (!classic_authenticateBlock (blockaddress)){
         Serial.println("Auth fail");
         return false;
     }
     
+    return classic_readBlock(blockaddress, block);
+}
+
+/*
+ reads a block of the sector authenticated last
+ */
+boolean Mifare::classic_readBlock(uint8_t blockaddress, uint8_t * block) {
     packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
-    packetbuffer[1] = 1;  // either card 1 or 2 (tested for card 1)
+    packetbuffer[1] = target->tg;  // either card 1 or 2
     packetbuffer[2] = MIFARE_CMD_READ;
     packetbuffer[3] = blockaddress; //This address can be 0-63 for MIFARE 1K card
     
@@ -480,6 +2990,7 @@ boolean Mifare::classic_readMemoryBlock(uint8_t blockaddress, uint8_t * block) {
     if((packetbuffer[6] == 0x41) && (packetbuffer[7] == 0x00)){
         return true;
     }else{
+        forgetAuthentication();
         return false;
     }
 }
@@ -499,16 +3010,13 @@ boolean Mifare::classic_readMemoryBlock(uint8_t blockaddress, uint8_t * block) {
 /**************************************************************************/
 //Do not write to Sector Trailer Block unless you know what you are doing.
 boolean Mifare::classic_writeMemoryBlock (uint8_t blockaddress, uint8_t * block){
-    if (blockaddress >= 64) //64 blocks for a classic
-        return false;
-    
     if (!classic_authenticateBlock (blockaddress)){
         Serial.println("Authentication failed.");
         return false;
     }
     
     packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
-    packetbuffer[1] = 1;  // either card 1 or 2 (tested for card 1)
+    packetbuffer[1] = target->tg;  // either card 1 or 2
     packetbuffer[2] = MIFARE_CMD_WRITE_CLASSIC;
     packetbuffer[3] = blockaddress;
     
@@ -531,11 +3039,105 @@ boolean Mifare::classic_writeMemoryBlock (uint8_t blockaddress, uint8_t * block)
     if((packetbuffer[6] == 0x41) && (packetbuffer[7] == 0x00)) {
         return true; 
     }else{
+        forgetAuthentication();
         return false;
     }
 }
 
 
+/*
+ the access bits of a sector trailer (bytes 6..8) let key B be read when
+ C1 C2 C3 of the trailer are 000, 010 or 001. a readable key B can't
+ authenticate
+ */
+static boolean keyBReadable (const uint8_t * trailer){
+    uint8_t c1 = (trailer[7] >> 7) & 1;
+    uint8_t c2 = (trailer[8] >> 3) & 1;
+    uint8_t c3 = (trailer[8] >> 7) & 1;
+    
+    return c1 == 0 && !(c2 && c3);
+}
+
+
+/*
+ writes a classic block, or in differential mode reads it first and skips
+ the write when it already holds block. a failed write is retried after
+ recover. key A of a sector trailer reads back as zeros, so a trailer only
+ counts as unchanged when the access bits and GPB match, key A
+ authenticates and key B reads back the same or, when it can't be read,
+ authenticates too.
+ */
+boolean Mifare::classic_updateMemoryBlock (uint8_t blockaddress, uint8_t * block){
+    for (uint8_t attempt = 0; ; attempt++){
+        if (classic_storeBlock(blockaddress, block))
+            return true;
+        if (!recover(attempt))
+            return false;
+    }
+}
+
+boolean Mifare::classic_storeBlock (uint8_t blockaddress, uint8_t * block){
+    uint8_t current[16];
+    
+    if (writeMode != MIFARE_WRITE_DIFFERENTIAL)
+        return classic_writeCheckedBlock(blockaddress, block);
+    if (!classic_readMemoryBlock(blockaddress, current)){
+        // the failed authentication or READ halted the card
+        if (!targetCommand(PN532_COMMAND_INSELECT, target->tg))
+            return false;
+        return classic_writeCheckedBlock(blockaddress, block);
+    }
+    
+    if (classic_trailerBlock(blockaddress) != blockaddress){
+        if (memcmp(current, block, 16) == 0)
+            return true;
+        return classic_writeCheckedBlock(blockaddress, block);
+    }
+    
+    // key A always reads back as zeros, key B unless the access bits make it readable
+    if (memcmp(current + 6, block + 6, 4) == 0){
+        if (classic_authenticate(blockaddress, KEY_A, block)){
+            if (keyBReadable(block) && memcmp(current + 10, block + 10, 6) == 0)
+                return true;
+            if (!keyBReadable(block) && classic_authenticate(blockaddress, KEY_B, block + 10))
+                return true;
+        }
+        // a failed authentication halted the card, select it again either way
+        if (!targetCommand(PN532_COMMAND_INSELECT, target->tg))
+            return false;
+    }
+    return classic_writeCheckedBlock(blockaddress, block);
+}
+
+
+/*
+ writes a classic block and, with verify on, reads it back in the same
+ authentication. a trailer's key A reads back as zeros, only its access
+ bits and GPB are compared, and key B when it is readable
+ */
+boolean Mifare::classic_writeCheckedBlock (uint8_t blockaddress, uint8_t * block){
+    uint8_t current[16];
+    
+    if (!classic_writeMemoryBlock(blockaddress, block))
+        return false;
+    if (!verifyWrites)
+        return true;
+    
+    unsigned long start = millis();
+    boolean same = classic_readMemoryBlock(blockaddress, current);
+    
+    verifyReport.reads++;
+    verifyReport.time += millis() - start;
+    if (same && classic_trailerBlock(blockaddress) == blockaddress)
+        same = (memcmp(current + 6, block + 6, keyBReadable(block) ? 10 : 4) == 0);
+    else if (same)
+        same = (memcmp(current, block, 16) == 0);
+    if (!same)
+        verifyReport.mismatches++;
+    return same;
+}
+
+
 
 /**************************************************************************/
 /*!
@@ -543,17 +3145,39 @@ boolean Mifare::classic_writeMemoryBlock (uint8_t blockaddress, uint8_t * block)
 
  using 'block' for consistency however it refers to a ultralight page here
  
- @param  pageaddress  The page number (0..63 in most cases)
+ @param  pageaddress  The page number (0..63 in most cases, up to 230 on an NTAG216)
  @param  page         Pointer to the byte array that will hold the
  retrieved data (if any)
  */
 /**************************************************************************/
 boolean Mifare::ultralight_readMemoryBlock (uint8_t blockaddress, uint8_t *block){
-    if (blockaddress >= 64)
-        return false;
-    
+    return ultralight_read(blockaddress, block, 4);
+}
+
+
+/**************************************************************************/
+/*!
+ Reads the 4 pages (16 bytes) starting at the specified address, the
+ amount a single READ command returns.
+ 
+ @param  pageaddress  The first page number
+ @param  block        Pointer to the 16 byte array that will hold the
+ retrieved data (if any)
+ */
+/**************************************************************************/
+boolean Mifare::ultralight_readPages (uint8_t blockaddress, uint8_t *block){
+    return ultralight_read(blockaddress, block, 16);
+}
+
+
+/**************************************************************************/
+/*!
+ Sends a READ command and keeps the first length bytes of the response
+ */
+/**************************************************************************/
+boolean Mifare::ultralight_read (uint8_t blockaddress, uint8_t *block, uint8_t length){
     packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
-    packetbuffer[1] = 1;                   /* Card number */
+    packetbuffer[1] = target->tg;          /* Card number */
     packetbuffer[2] = MIFARE_CMD_READ;     /* Mifare Read command = 0x30 */
     packetbuffer[3] = blockaddress;         /* Page Number (0..63 in most cases) */
     
@@ -568,7 +3192,7 @@ boolean Mifare::ultralight_readMemoryBlock (uint8_t blockaddress, uint8_t *block
 #endif
     
 #ifdef MIFAREDEBUG
-    for(uint8_t i=8;i<12;i++) {
+    for(uint8_t i=8;i<8+length;i++) {
          Serial.print(packetbuffer[i], HEX); Serial.print(" ");
     }
     Serial.println("");
@@ -576,12 +3200,12 @@ boolean Mifare::ultralight_readMemoryBlock (uint8_t blockaddress, uint8_t *block
     
     /* If byte 8 isn't 0x00 we probably have an error */
     if (packetbuffer[7] == 0x00) {
-        /* Copy the 4 data bytes to the output buffer         */
+        /* Copy the data bytes to the output buffer           */
         /* Block content starts at byte 9 of a valid response */
         /* Note that the command actually reads 16 byte or 4  */
-        /* pages at a time ... we simply discard the last 12  */
-        /* bytes                                              */
-        memcpy (block, packetbuffer+8, 4);
+        /* pages at a time ... for a single page we simply    */
+        /* discard the last 12 bytes                          */
+        memcpy (block, packetbuffer+8, length);
         return true;
     }else{
 #ifdef MIFAREDEBUG
@@ -596,18 +3220,15 @@ boolean Mifare::ultralight_readMemoryBlock (uint8_t blockaddress, uint8_t *block
 /*!
  Tries to read an entire 4-byte page at the specified address.
  
- @param  pageaddress  The page number (0..63 in most cases)
+ @param  pageaddress  The page number (0..63 in most cases, up to 230 on an NTAG216)
  @param  page         Pointer to the byte array that will hold the
  retrieved data (if any)
  */
 /**************************************************************************/
 
 boolean Mifare::ultralight_writeMemoryBlock (uint8_t blockaddress, uint8_t *block){
-    if (blockaddress >= 64)
-        return false;
-    
     packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
-    packetbuffer[1] = 1;                   /* Card number */
+    packetbuffer[1] = target->tg;          /* Card number */
     packetbuffer[2] = MIFARE_CMD_WRITE_ULTRALIGHT;
     packetbuffer[3] = blockaddress;         /* Page Number (0..63 in most cases) */
     
@@ -628,3 +3249,193 @@ boolean Mifare::ultralight_writeMemoryBlock (uint8_t blockaddress, uint8_t *bloc
     }else{
         return false;
     }}
+
+
+/*
+ writes count (1..4) pages from blockaddress, in differential mode only the
+ ones that differ from what a single READ returns. with verify on, a READ
+ after the writes checks them and the pages that differ are written again
+ */
+boolean Mifare::ultralight_updatePages (uint8_t blockaddress, uint8_t *pages, uint8_t count){
+    uint8_t current[16];
+    boolean compare = (writeMode == MIFARE_WRITE_DIFFERENTIAL) && ultralight_readPages(blockaddress, current);
+    
+    for (uint8_t check = 0; ; check++){
+        for (uint8_t i = 0; i < count; i++){
+            if (compare && memcmp(current + i * 4, pages + i * 4, 4) == 0)
+                continue;
+            if (check > 0)
+                verifyReport.mismatches++;
+            for (uint8_t attempt = 0; !ultralight_writeMemoryBlock(blockaddress + i, pages + i * 4); attempt++){
+                if (!recover(attempt))
+                    return false;
+            }
+        }
+        if (!verifyWrites)
+            return true;
+        
+        // one READ returns every page just written, the ones that differ go round again
+        unsigned long start = millis();
+        compare = ultralight_readPages(blockaddress, current);
+        verifyReport.reads++;
+        verifyReport.time += millis() - start;
+        if (compare && memcmp(current, pages, count * 4) == 0)
+            return true;
+        if (!recover(check))
+            return false;
+    }
+}
+
+
+/**************************************************************************/
+/*!
+ Sends data to the I2C side of an NTAG I2C plus through its SRAM, 64 bytes
+ per FAST_WRITE instead of 4 per EEPROM page WRITE (SRAM page WRITEs when
+ the transport can't write the FAST_WRITE frame, see ntag_fastWrite). The host on the I2C
+ side must have turned pass-through on in the RF to I2C direction. Before
+ each transfer the session registers are read until that host took the
+ previous one. The last transfer is padded with zeros.
+ 
+ @returns false if pass-through is off, the I2C side doesn't keep up
+ within MIFARE_SRAM_POLLS reads, or a write fails
+ */
+/**************************************************************************/
+boolean Mifare::writeSram(MIFARE_SESSION * s, const uint8_t * data, uint16_t length) {
+    uint8_t sram[NTAG_SRAM_SIZE];
+    
+    if (!activate(s) || cardType != MIFARE_ULTRALIGHT)
+        return false;
+    
+    for (uint16_t offset = 0; offset < length; offset += NTAG_SRAM_SIZE) {
+        uint8_t n = (length - offset < NTAG_SRAM_SIZE) ? length - offset : NTAG_SRAM_SIZE;
+        
+        if (!ntag_waitSram(NTAG_NC_TRANSFER_DIR, NTAG_NS_SRAM_I2C_READY, 0))
+            return false;
+        memcpy(sram, data + offset, n);
+        memset(sram + n, 0, NTAG_SRAM_SIZE - n);
+        if (!ntag_fastWrite(sram))
+            return false;
+    }
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Receives data from the I2C side of an NTAG I2C plus through its SRAM, 64
+ bytes per FAST_READ, or per few FAST_READs on a transport that reads
+ shorter frames. Pass-through must be on in the I2C to RF direction,
+ each transfer is read once the I2C side has filled the SRAM.
+ 
+ @returns false if pass-through is off, the I2C side doesn't fill the SRAM
+ within MIFARE_SRAM_POLLS reads, or a read fails
+ */
+/**************************************************************************/
+boolean Mifare::readSram(MIFARE_SESSION * s, uint8_t * data, uint16_t length) {
+    uint8_t sram[NTAG_SRAM_SIZE];
+    
+    if (!activate(s) || cardType != MIFARE_ULTRALIGHT)
+        return false;
+    
+    for (uint16_t offset = 0; offset < length; offset += NTAG_SRAM_SIZE) {
+        uint8_t n = (length - offset < NTAG_SRAM_SIZE) ? length - offset : NTAG_SRAM_SIZE;
+        
+        if (!ntag_waitSram(0, NTAG_NS_SRAM_RF_READY, NTAG_NS_SRAM_RF_READY))
+            return false;
+        if (!ntag_fastRead(sram))
+            return false;
+        memcpy(data + offset, sram, n);
+    }
+    return true;
+}
+
+
+/*
+ reads the session registers until NS_REG & flag == value. fails at once
+ when pass-through is off or runs in the other direction
+ */
+boolean Mifare::ntag_waitSram (uint8_t direction, uint8_t flag, uint8_t value){
+    uint8_t registers[8];
+    
+    for (uint8_t poll = 0; poll < MIFARE_SRAM_POLLS; poll++) {
+        if (!ultralight_read(NTAG_SESSION_PAGE, registers, 8))
+            return false;
+        if (!(registers[0] & NTAG_NC_PTHRU_ON_OFF) || (registers[0] & NTAG_NC_TRANSFER_DIR) != direction)
+            return false;
+        if ((registers[6] & flag) == value)
+            return true;
+        delay(1);
+    }
+    
+#ifdef MIFAREDEBUG
+    Serial.println("SRAM not ready");
+#endif
+    return false;
+}
+
+
+/*
+ FAST_WRITE of the whole SRAM. the frame is longer than packetbuffer, it
+ is built on the stack. FAST_WRITE must cover the whole SRAM, a transport
+ that can't write the 69 byte command gets the pages one WRITE at a time.
+ either way the I2C side sees the data once page FFh is written.
+ */
+boolean Mifare::ntag_fastWrite (const uint8_t * data){
+    uint8_t command[5 + NTAG_SRAM_SIZE];
+    
+    if (sizeof(command) > board->commandlimit()){
+        for (uint8_t page = 0; page < NTAG_SRAM_SIZE / 4; page++){
+            memcpy(command, data + page * 4, 4);
+            if (!ultralight_writeMemoryBlock(NTAG_SRAM_PAGE + page, command))
+                return false;
+        }
+        return true;
+    }
+    
+    command[0] = PN532_COMMAND_INDATAEXCHANGE;
+    command[1] = target->tg;
+    command[2] = NTAG_CMD_FAST_WRITE;
+    command[3] = NTAG_SRAM_PAGE;
+    command[4] = NTAG_SRAM_PAGE + NTAG_SRAM_SIZE / 4 - 1;
+    memcpy(command + 5, data, NTAG_SRAM_SIZE);
+    
+    if (! board->sendCommandCheckAck(command, sizeof(command)))
+        return false;
+    
+    board->readdata(packetbuffer, 8);
+    return (packetbuffer[6] == 0x41) && ((packetbuffer[7] & 0x3F) == 0x00);
+}
+
+
+/*
+ FAST_READ of the whole SRAM, the response is read on the stack like the
+ FAST_WRITE frame. a transport that reads shorter frames gets the pages in
+ as many FAST_READs as it takes, in order, the I2C side sees the SRAM read
+ once page FFh is.
+ */
+boolean Mifare::ntag_fastRead (uint8_t * data){
+    uint8_t response[8 + NTAG_SRAM_SIZE + 2];
+    uint8_t limit = board->responselimit();
+    uint8_t pages = (limit < sizeof(response)) ? (limit - 10) / 4 : NTAG_SRAM_SIZE / 4;
+    
+    for (uint8_t first = 0; first < NTAG_SRAM_SIZE / 4; first += pages){
+        uint8_t last = (first + pages < NTAG_SRAM_SIZE / 4) ? first + pages - 1 : NTAG_SRAM_SIZE / 4 - 1;
+        uint8_t length = (last - first + 1) * 4;
+        
+        packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
+        packetbuffer[1] = target->tg;
+        packetbuffer[2] = NTAG_CMD_FAST_READ;
+        packetbuffer[3] = NTAG_SRAM_PAGE + first;
+        packetbuffer[4] = NTAG_SRAM_PAGE + last;
+        
+        if (! board->sendCommandCheckAck(packetbuffer, 5))
+            return false;
+        
+        board->readdata(response, 8 + length + 2);
+        if ((response[6] != 0x41) || ((response[7] & 0x3F) != 0x00) || response[3] != 3 + length)
+            return false;
+        
+        memcpy(data + first * 4, response + 8, length);
+    }
+    return true;
+}
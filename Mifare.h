@@ -12,6 +12,8 @@
 #include "PN532_Com.h"
 
 #define MIFARE_ISO14443A              (0x00)
+#define MIFARE_FELICA_212             (0x01)
+#define MIFARE_FELICA_424             (0x02)
 
 // Mifare Commands
 #define MIFARE_CMD_AUTH_A                   (0x60)
@@ -23,18 +25,208 @@
 #define MIFARE_CMD_DECREMENT                (0xC0)
 #define MIFARE_CMD_INCREMENT                (0xC1)
 #define MIFARE_CMD_STORE                    (0xC2)
+#define MIFARE_CMD_GET_VERSION              (0x60)   /* ultralight EV1 and NTAG21x, InCommunicateThru only: InDataExchange takes 0x60 for AUTH_A */
 #define STOP_BYTE                           (0XFE)
 
+// NTAG I2C plus, read with the ultralight commands
+#define NTAG_CMD_FAST_READ                  (0x3A)
+#define NTAG_CMD_FAST_WRITE                 (0xA6)
+#define NTAG_SRAM_PAGE                      (0xF0)   /* SRAM pages F0h..FFh in pass-through mode */
+#define NTAG_SRAM_SIZE                      (64)
+#define NTAG_SESSION_PAGE                   (0xEC)   /* session registers, NC_REG at byte 0, NS_REG at byte 6 */
+#define NTAG_NC_PTHRU_ON_OFF                (0x40)
+#define NTAG_NC_TRANSFER_DIR                (0x01)   /* set: RF to I2C */
+#define NTAG_NS_SRAM_RF_READY               (0x08)   /* the I2C side filled the SRAM */
+#define NTAG_NS_SRAM_I2C_READY              (0x10)   /* the I2C side hasn't read the SRAM yet */
+
+// FeliCa commands, sent with their length byte in front
+#define FELICA_CMD_POLLING                  (0x00)
+#define FELICA_CMD_REQUEST_RESPONSE         (0x04)
+#define FELICA_CMD_READ_WITHOUT_ENCRYPTION  (0x06)
+#define FELICA_SYSTEM_NDEF                  (0x12FC)
+#define FELICA_SYSTEM_ANY                   (0xFFFF)
+#define FELICA_SERVICE_NDEF_READ            (0x000B)   /* type 3 tag NDEF, read only access */
+
+// NDEF TLV blocks (NFC Forum Type 1/2 Tag Operation, Mifare Classic mapping)
+#define NDEF_TLV_NULL                       (0x00)
+#define NDEF_TLV_LOCK_CONTROL               (0x01)
+#define NDEF_TLV_MEMORY_CONTROL             (0x02)
+#define NDEF_TLV_MESSAGE                    (0x03)
+#define NDEF_TLV_PROPRIETARY                (0xFD)
+#define NDEF_TLV_TERMINATOR                 (0xFE)
+#define NDEF_TLV_LONG_LENGTH                (0xFF)
+
+#define NDEF_CC_MAGIC                       (0xE1)   /* Ultralight page 3, byte 0 */
+#define CLASSIC_1K_DATA_SIZE                (720)    /* sectors 1..15, 3 blocks of 16 bytes */
+#define CLASSIC_4K_DATA_SIZE                (3360)   /* + sectors 17..31, and 32..39 with 15 blocks */
+#define ULTRALIGHT_DATA_SIZE                (240)    /* pages 4..63 when there is no capability container */
+
 #define MIFARE_CLASSIC      0x000408 /* ATQA 00 04	 SAK 08 */
+#define MIFARE_CLASSIC_4K   0x000218 /* ATQA 00 02	 SAK 18 */
 #define MIFARE_ULTRALIGHT   0x004400 /* ATQA 00 44	 SAK 00 */
+#define MIFARE_DESFIRE      0x034420 /* ATQA 03 44	 SAK 20, read as an NFC Forum type 4 tag */
+#define MIFARE_SAK_ISODEP   0x20     /* SAK bit of ISO14443-4 (type 4) targets */
+#define MIFARE_FELICA       0x01000000 /* not ATQA and SAK, the type of targets found by readFeliCaTarget */
+
+#define MIFARE_MAX_TARGETS  2
+#ifndef MIFARE_PACKBUFFSIZE
+#define MIFARE_PACKBUFFSIZE 64   /* two targets with 7 byte UIDs don't fit in PN532_PACKBUFFSIZE.
+                                    type 4 reads get MIFARE_PACKBUFFSIZE - 12 bytes per READ BINARY,
+                                    less on a bus that reads short frames (see PN532::responselimit),
+                                    up to 255 on boards with the RAM and a bus that reads whole frames */
+#endif
+#define MIFARE_CHUNK_MAX        (MIFARE_PACKBUFFSIZE - 12)          /* longest chunk handed to a MIFARE_BLOCK_CALLBACK */
+#define MIFARE_TARGETS_READSIZE (8 + MIFARE_MAX_TARGETS * 12 + 2)   /* one target per InListPassiveTarget when a frame is shorter */
+#define MIFARE_FELICA_READSIZE  (8 + MIFARE_MAX_TARGETS * 21 + 2)   /* Tg, POL_RES with IDm, PMm and system code */
+#define MIFARE_FAST_READ_PAGES  ((MIFARE_PACKBUFFSIZE - 10) / 4)    /* pages in a FAST_READ response, fewer on I2C */
+#define FELICA_MAX_BLOCKS   ((MIFARE_PACKBUFFSIZE - 23) / 16)   /* blocks in a Read Without Encryption response */
 
 #define KEY_A	1
 #define KEY_B	2
 
+// well known keys, to fill a MIFARE_KEY
+#define MIFARE_KEY_DEFAULT  {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}   /* factory */
+#define MIFARE_KEY_MAD      {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5}   /* MAD sectors */
+#define MIFARE_KEY_NDEF     {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7}   /* NDEF public key */
+
+#define MIFARE_SECTOR_MAP_SIZE  5    /* one bit per classic sector, 40 on a 4K card */
+#define MIFARE_RETRIES      2    /* block retries after selecting the card again, see Mifare::setRetries */
+#define MIFARE_KEYHITS      8    /* cards and sectors remembered by the key dictionary */
+#define MIFARE_FIELD_OFF_TIME   10  /* ms without field for halted tags to reset, see Mifare::inventory */
+#define MIFARE_SRAM_POLLS   100  /* NS_REG reads waiting for the I2C side of an NTAG I2C, about 1 ms each */
+
+// write modes, see Mifare::setWriteMode
+#define MIFARE_WRITE_FULL           0   /* write every block and page */
+#define MIFARE_WRITE_DIFFERENTIAL   1   /* read first, write only what changed */
+
+// what checking the last payload write cost, see Mifare::setVerify
+struct MIFARE_VERIFY{
+    uint16_t reads;         // READs of written blocks and pages
+    uint16_t mismatches;    // blocks and pages found different and written again
+    unsigned long time;     // ms spent in the READs
+};
+
+// card images, see Mifare::dump
+#define MIFARE_IMAGE_VERSION        1
+#define MIFARE_IMAGE_HEADER         16  /* version, card type (3), memory size (2), UID length, UID (up to 7), 2 zero bytes */
+
 //#define MIFAREDEBUG 1
 
 extern PN532 * board;
 
+// a target found by readTarget
+struct MIFARE_TARGET{
+    uint8_t tg;             // target number used by the PN532
+    uint16_t atqa;          // SENS_RES
+    uint8_t sak;            // SEL_RES
+    uint32_t type;          // ATQA and SAK, compare with MIFARE_CLASSIC etc
+    uint8_t uidLength;
+    uint8_t uid[10];        // the IDm of FeliCa targets
+};
+
+// an entry of the key dictionary, see Mifare::setKeyDictionary
+struct MIFARE_KEY{
+    uint8_t type;           // KEY_A or KEY_B
+    uint8_t key[6];
+};
+
+struct MIFARE_KEYHIT{
+    uint8_t uid[4];
+    uint8_t sector;
+    uint8_t key;            // index in the dictionary, 0xFF for none
+};
+
+// a PN532 register and its value, see Mifare::readRegisters. an array of
+// them is a tuning profile
+struct MIFARE_REGISTER{
+    uint16_t address;       // PN532_REG_CIU_RFCFG etc
+    uint8_t value;
+};
+
+#define MIFARE_REGISTERS_READ   ((MIFARE_PACKBUFFSIZE - 1) / 2)    /* registers per ReadRegister frame, fewer on I2C */
+#define MIFARE_REGISTERS_WRITE  ((MIFARE_PACKBUFFSIZE - 1) / 3)    /* registers per WriteRegister frame, fewer on I2C */
+
+// a UID collected by Mifare::inventory
+struct MIFARE_UID{
+    uint8_t length;
+    uint8_t uid[10];
+};
+
+// the tags found by Mifare::inventory
+struct MIFARE_INVENTORY{
+    MIFARE_UID * uids;      // set by the caller
+    uint8_t size;           // number of uids, set by the caller
+    uint8_t count;          // distinct UIDs found
+    uint8_t rounds;         // InListPassiveTarget commands sent
+    boolean overflow;       // more tags than size, uids holds the first ones
+    unsigned long time;     // ms taken
+    uint16_t rate;          // tags per second
+};
+
+#define MIFARE_SESSION_IDLE         0   // released, or never detected
+#define MIFARE_SESSION_SELECTED     1
+#define MIFARE_SESSION_DESELECTED   2   // InDeselect, select picks it up again
+
+// a detected target kept selected across operations, see Mifare::detect
+struct MIFARE_SESSION{
+    MIFARE_TARGET target;
+    uint8_t state;
+    boolean mapped;         // classic MAD read during this session, sectors is valid
+    boolean formatted;      // the MAD gives sectors to NDEF, no need to format
+    uint8_t sectors[MIFARE_SECTOR_MAP_SIZE];    // NDEF sectors, bit n of byte n/8 for sector n
+};
+
+#define MIFARE_OP_READ      0
+#define MIFARE_OP_WRITE     1
+
+/*
+ a block operation for Mifare::execute. data holds a block: 16 bytes on
+ classic, one 4 byte page on ultralight
+ */
+struct MIFARE_OP{
+    uint8_t operation;      // MIFARE_OP_READ or MIFARE_OP_WRITE
+    uint8_t blockaddress;   // classic block or ultralight page
+    uint8_t * data;
+    boolean success;        // set by execute
+};
+
+#define MIFARE_PROVISION_OPS    ((CLASSIC_4K_DATA_SIZE / 16) + 38)    /* most ops a payload can need, a full 4K card */
+
+// a payload written to tag after tag by Mifare::provision, see
+// Mifare::prepareProvisioning
+struct MIFARE_PROVISION{
+    uint8_t * payload;      // TLV from NDEF::encode_*, kept by the caller
+    uint16_t length;
+    MIFARE_OP * ops;        // set by the caller, one per page or block written
+    uint8_t size;           // number of ops, set by the caller
+    uint8_t count;          // ops prepared
+    uint32_t type;          // card type the ops were prepared for, 0 for none
+    uint8_t tail[16];       // last block or page, zero padded
+    uint8_t trailer[16];    // classic sector trailer with keyA and keyB
+    boolean verify;         // read the message back after writing, set by the caller
+    uint16_t tags;          // tags written (and verified)
+    uint16_t failures;      // tags that failed
+    unsigned long start;    // millis() at prepareProvisioning
+    unsigned long time;     // ms spent writing and verifying
+    uint16_t rate;          // tags per minute since start
+};
+
+/*
+ called by Mifare::streamPayload for every chunk of the NDEF message read from
+ the card, at most what one read returned: a block on classic and ultralight,
+ a READ BINARY on type 4, several blocks on type 3, never more than
+ MIFARE_CHUNK_MAX bytes. offset is the position of data in the message,
+ total the length of the whole message. return false to stop reading.
+ */
+typedef boolean (*MIFARE_BLOCK_CALLBACK)(uint8_t * data, uint8_t length, uint16_t offset, uint16_t total, void * context);
+
+/*
+ called by Mifare::dump with length bytes of the image at offset, and by
+ Mifare::restore to fill data with length bytes of the image from offset
+ (in any order). return false to stop.
+ */
+typedef boolean (*MIFARE_IMAGE_CALLBACK)(uint8_t * data, uint8_t length, uint16_t offset, void * context);
+
 class Mifare{
   public:
 	Mifare();
@@ -45,24 +237,131 @@ class Mifare{
     static uint32_t cardType;
     
 	boolean SAMConfig(void);
+    boolean setPassiveActivationRetries(uint8_t retries);
+    void setKeyDictionary(const MIFARE_KEY * keys, uint8_t count);
+    void setWriteMode(uint8_t mode);
+    void setRetries(uint8_t count);
+    void setVerify(boolean verify);
+    MIFARE_VERIFY * getVerifyReport(void);
+    boolean readRegisters(MIFARE_REGISTER * registers, uint8_t count);
+    boolean writeRegisters(const MIFARE_REGISTER * registers, uint8_t count);
     uint8_t* readTarget(uint16_t timeout = 0);
+    boolean useTarget(uint8_t number);
+    uint8_t getTargetCount(void);
+    MIFARE_TARGET * getTarget(uint8_t number);
+    boolean inventory(MIFARE_INVENTORY * inventory, uint16_t timeout = 0);
+    uint8_t* readFeliCaTarget(uint8_t baudRate = MIFARE_FELICA_424, uint16_t systemCode = FELICA_SYSTEM_NDEF, uint16_t timeout = 0);
+    
+    MIFARE_SESSION * detect(uint16_t timeout = 0);
+    MIFARE_SESSION * detectFeliCa(uint8_t baudRate = MIFARE_FELICA_424, uint16_t timeout = 0);
+    MIFARE_SESSION * getSession(uint8_t number);
+    boolean select(MIFARE_SESSION * s);
+    boolean deselect(MIFARE_SESSION * s);
+    boolean release(MIFARE_SESSION * s);
+    boolean checkPresence(MIFARE_SESSION * s);
     
-    boolean readPayload(uint8_t * output , uint8_t lengthLimit);
-    boolean writePayload(uint8_t * payload, uint8_t length);
+    boolean readPayload(uint8_t * output , uint16_t lengthLimit);
+    boolean streamPayload(MIFARE_BLOCK_CALLBACK callback, void * context);
+    boolean writePayload(uint8_t * payload, uint16_t length);
+    
+    boolean readPayload(MIFARE_SESSION * s, uint8_t * output, uint16_t lengthLimit);
+    boolean streamPayload(MIFARE_SESSION * s, MIFARE_BLOCK_CALLBACK callback, void * context);
+    boolean writePayload(MIFARE_SESSION * s, uint8_t * payload, uint16_t length);
+    
+    boolean readFingerprint(MIFARE_SESSION * s, uint16_t * fingerprint);
+    boolean readFingerprint(MIFARE_SESSION * s, uint16_t * fingerprint, uint8_t * block);
+    boolean execute(MIFARE_SESSION * s, MIFARE_OP * ops, uint8_t count);
+    
+    boolean prepareProvisioning(MIFARE_PROVISION * provision, uint8_t * payload, uint16_t length);
+    boolean provision(MIFARE_PROVISION * provision, uint16_t timeout = 0);
+    
+    boolean dump(MIFARE_SESSION * s, MIFARE_IMAGE_CALLBACK callback, void * context);
+    boolean restore(MIFARE_SESSION * s, MIFARE_IMAGE_CALLBACK callback, void * context);
+    
+    boolean formatValue(MIFARE_SESSION * s, uint8_t blockaddress, int32_t value);
+    boolean readValue(MIFARE_SESSION * s, uint8_t blockaddress, int32_t * value);
+    boolean incrementValue(MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta);
+    boolean decrementValue(MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta);
+    boolean incrementValue(MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta, uint8_t destination);
+    boolean decrementValue(MIFARE_SESSION * s, uint8_t blockaddress, uint32_t delta, uint8_t destination);
+    boolean restoreValue(MIFARE_SESSION * s, uint8_t blockaddress, uint8_t destination);
+    
+    boolean readFeliCaBlocks(MIFARE_SESSION * s, uint16_t serviceCode, uint16_t blockNumber, uint8_t count, uint8_t * output);
+    
+    boolean writeSram(MIFARE_SESSION * s, const uint8_t * data, uint16_t length);
+    boolean readSram(MIFARE_SESSION * s, uint8_t * data, uint16_t length);
     
   private:
-    boolean classic_formatForNDEF(void);
+    boolean setField(boolean on);
+    boolean listTargets(uint8_t baudRate, const uint8_t * initiatorData, uint8_t length, uint16_t timeout, uint8_t readSize);
+    uint8_t readTargetRecords(void);
+    boolean targetCommand(uint8_t command, uint8_t tg);
+    boolean activate(MIFARE_SESSION * s);
+    boolean recover(uint8_t attempt);
+    boolean stream(MIFARE_BLOCK_CALLBACK callback, void * context);
+    boolean write(uint8_t * payload, uint16_t length);
+    boolean provisionTarget(MIFARE_PROVISION * provision);
+    boolean prepareOperations(MIFARE_PROVISION * provision);
+    
+    uint8_t blockSize(void);
+    uint8_t frameSize(void);
+    boolean readDataBlock(uint8_t index, uint8_t * block);
+    boolean requestDataBlock(uint8_t index);
+    boolean collectDataBlock(uint8_t * block);
+    boolean readDataByte(uint16_t position, uint8_t * block, uint8_t * loaded, uint8_t * value);
+    boolean streamMessageTLV(MIFARE_BLOCK_CALLBACK callback, void * context);
+    
+    boolean classic_formatForNDEF(uint16_t length);
+    boolean classic_allocateSectors(uint8_t * mad, uint16_t length);
+    boolean classic_readDirectory(void);
+    boolean classic_readDirectoryBlocks(uint8_t blockaddress, uint8_t * data);
+    void classic_mapAllSectors(void);
+    uint16_t classic_mapSize(void);
     boolean classic_authenticateBlock (uint32_t blockNumber);
+    boolean classic_authenticate (uint8_t blockNumber, uint8_t keyType, const uint8_t * keyData);
+    const uint8_t * classic_sectorKey(uint8_t sector, uint8_t * keyType);
     
-    boolean classic_readPayload(uint8_t * output, uint8_t lengthLimit);
-    boolean classic_writePayload(uint8_t * payload, uint8_t length);
+    boolean classic_streamPayload(MIFARE_BLOCK_CALLBACK callback, void * context);
+    boolean classic_writePayload(uint8_t * payload, uint16_t length);
+    uint8_t classic_dataBlock(uint8_t index);
+    uint8_t classic_trailerBlock(uint8_t blockaddress);
     boolean classic_readMemoryBlock(uint8_t blockaddress, uint8_t * block);
+    boolean classic_readBlock(uint8_t blockaddress, uint8_t * block);
     boolean classic_writeMemoryBlock(uint8_t blockaddress, uint8_t * block);
+    boolean classic_updateMemoryBlock(uint8_t blockaddress, uint8_t * block);
+    boolean classic_storeBlock(uint8_t blockaddress, uint8_t * block);
+    boolean classic_writeCheckedBlock(uint8_t blockaddress, uint8_t * block);
+    boolean classic_valueOperation(uint8_t command, uint8_t blockaddress, uint32_t operand, uint8_t destination);
+    boolean classic_dataExchange(uint8_t * command, uint8_t length);
+    boolean classic_dump(MIFARE_IMAGE_CALLBACK callback, void * context);
+    boolean classic_restore(uint16_t size, MIFARE_IMAGE_CALLBACK callback, void * context);
     
-    boolean ultralight_readPayload(uint8_t * output, uint8_t lengthLimit);
-    boolean ultralight_writePayload(uint8_t * payload, uint8_t length);
+    boolean type4_streamPayload(MIFARE_BLOCK_CALLBACK callback, void * context);
+    boolean type4_selectFile(uint16_t fileID);
+    boolean type4_readBinary(uint16_t offset, uint8_t length, uint8_t ** data, uint8_t * received);
+    boolean type4_exchange(const uint8_t * apdu, uint8_t length, uint8_t ** response, uint8_t * responseLength);
+    
+    boolean type3_streamPayload(MIFARE_BLOCK_CALLBACK callback, void * context);
+    boolean felica_readWithoutEncryption(uint16_t serviceCode, uint16_t blockNumber, uint8_t count, uint8_t ** data);
+    boolean felica_exchange(uint8_t length, uint8_t responseCode);
+    uint8_t felica_maxBlocks(void);
+    
+    boolean ultralight_streamPayload(MIFARE_BLOCK_CALLBACK callback, void * context);
+    boolean ultralight_writePayload(uint8_t * payload, uint16_t length);
+    boolean ultralight_readCapabilityContainer(void);
     boolean ultralight_readMemoryBlock(uint8_t blockaddress, uint8_t *block);
+    boolean ultralight_readPages(uint8_t blockaddress, uint8_t *block);
+    boolean ultralight_read(uint8_t blockaddress, uint8_t *block, uint8_t length);
     boolean ultralight_writeMemoryBlock(uint8_t blockaddress, uint8_t *block);
+    boolean ultralight_updatePages(uint8_t blockaddress, uint8_t *pages, uint8_t count);
+    boolean ultralight_readLayout(uint8_t * pages, uint8_t * dataEnd, uint8_t * lockPage, boolean * fastRead);
+    boolean ultralight_fastRead(uint8_t first, uint8_t last, uint8_t ** data);
+    boolean ultralight_dump(MIFARE_IMAGE_CALLBACK callback, void * context);
+    boolean ultralight_restore(uint16_t size, MIFARE_IMAGE_CALLBACK callback, void * context);
+    
+    boolean ntag_waitSram(uint8_t direction, uint8_t flag, uint8_t value);
+    boolean ntag_fastWrite(const uint8_t * data);
+    boolean ntag_fastRead(uint8_t * data);
     
 };
 
@@ -14,13 +14,18 @@ NDEF::NDEF(){
 /**
  * Parse the actual NDEF message and call specific handlers for dealing with
  * a particular type of NDEF message.
+ * The message is decoded in place, text and MIME payloads point into msg.
  *
- * @param msg  The NDEF message
- * @return     struct FOUND_MESSAGE which contains type, format, and the actual payload
+ * @param msg  The NDEF message TLV, as returned by Mifare::readPayload
+ * @return     struct FOUND_MESSAGE which contains type, format, the actual payload and its length
  */
 FOUND_MESSAGE NDEF::decode_message(uint8_t * msg) {
-    int offset = 2;
-    FOUND_MESSAGE m;
+    // skip the TLV header, 0x03 followed by a 1 byte or 0xFF and a 2 byte length
+    int offset = (msg[1] == 0xFF) ? 4 : 2;
+    FOUND_MESSAGE m = { 0, 0, 0, 0 };
+    static char uri [NDEF_BUFFER_SIZE];
+    static char lang [3];
+    static char mimetype [NDEF_MIME_TYPE_SIZE];
 
     bool mb = (*(msg + offset) & 0x80) == 0x80;        /* Message Begin */
     bool me = (*(msg + offset) & 0x40) == 0x40;        /* Message End */
@@ -47,12 +52,13 @@ FOUND_MESSAGE NDEF::decode_message(uint8_t * msg) {
     int typeLength = *(msg + offset);
     offset++;
         
-    int payloadLength;
+    uint16_t payloadLength;
     if (sr) {
         payloadLength = *(msg + offset);
-        payloadLength = (payloadLength < 0) ? payloadLength + 256 : payloadLength;
         offset++;
     } else {
+        // 4 byte payload length, messages never go past 16 bits
+        payloadLength = (*(msg + offset + 2) << 8) | *(msg + offset + 3);
         offset += 4;
     }
         
@@ -72,11 +78,7 @@ FOUND_MESSAGE NDEF::decode_message(uint8_t * msg) {
                 offset += idLength;
             }
                 
-            memcpy(msg, msg + offset, payloadLength);
-            offset += payloadLength;
-            char lang [3];
-            char text [NDEF_BUFFER_SIZE];
-            char uri [NDEF_BUFFER_SIZE];
+            memmove(msg, msg + offset, payloadLength);
             
             switch (m.type) {
                 case NDEF_TYPE_URI:
@@ -84,14 +86,16 @@ FOUND_MESSAGE NDEF::decode_message(uint8_t * msg) {
 //                      Serial.print("uri: "); Serial.println(uri);
                         m.format = (char *)(uint8_t)msg[0];
                         m.payload = (uint8_t*)uri;
+                        m.length = strlen(uri);
                     }
                     break;
                 case NDEF_TYPE_TEXT:	
-                    if(parse_text(msg, payloadLength, lang, text)) {
+                    if(parse_text(msg, payloadLength, lang, (char *)msg)) {
 //                      Serial.print("lang: "); Serial.println(lang);
 //                      Serial.print("text: "); Serial.println(text);
                         m.format = (char *)(uint8_t*)lang;
-                        m.payload = (uint8_t*)text;
+                        m.payload = msg;
+                        m.length = payloadLength - 3;
                     }
                     break;
                 default:
@@ -99,23 +103,26 @@ FOUND_MESSAGE NDEF::decode_message(uint8_t * msg) {
                     break;
                 }
             break;
-        case 2:
+        case 2: {
             //mime type record
             m.type = NDEF_TYPE_MIME;
             
-            char mimetype [typeLength-2];
-            uint8_t payload [NDEF_BUFFER_SIZE];
+            uint8_t mimeLength = (typeLength < NDEF_MIME_TYPE_SIZE) ? typeLength : NDEF_MIME_TYPE_SIZE - 1;
+            memcpy(mimetype, msg + offset, mimeLength);
+            mimetype[mimeLength] = 0x00;
             
-            memcpy(mimetype, msg+offset, typeLength);
-            memcpy(payload, msg +typeLength +offset, payloadLength - typeLength);
+            offset += typeLength + idLength;
+            memmove(msg, msg + offset, payloadLength);
                 
 //            Serial.print("mimetype: "); Serial.println(mimetype);
 //            Serial.print("data: "); Serial.println((char*)payload);
             
             m.format = mimetype;
-            m.payload = payload;
+            m.payload = msg;
+            m.length = payloadLength;
                 
             break;
+        }
         default:
             Serial.println("err");
             break;
@@ -132,26 +139,11 @@ FOUND_MESSAGE NDEF::decode_message(uint8_t * msg) {
  * @return              length of the encoded message
  */
 
-uint8_t	NDEF::encode_URI(uint8_t uriPrefix, uint8_t * msg){
-    uint8_t len = strlen((char *)msg);
-    
-    uint8_t record_header = encode_record_header(1, 1, 0, 1, 0, NDEF_WELL_KNOWN_RECORD);
-    
-    uint8_t payload_head[7] = {0x03, len+5, record_header, 0x01, len+1, 0x55, uriPrefix};
-    const uint8_t term[1] ={0xFE};
-
-    memmove(msg+7, msg, len);
-    memcpy(msg+0, payload_head, 7);
-    memcpy(msg + len + 7, term , 1);
-#ifdef DEBUG
-    for (uint8_t i = 0 ; i < len + 8; i++) {
-        Serial.print(msg[i], HEX);Serial.print(" ");
-    }
-    Serial.println("");
-#endif    
-    
-    return len + 8;
+uint16_t NDEF::encode_URI(uint8_t uriPrefix, uint8_t * msg){
+    uint16_t len = strlen((char *)msg);
+    uint8_t type[1] = {NDEF_TYPE_URI};
     
+    return encode_message(msg, len, NDEF_WELL_KNOWN_RECORD, type, 1, &uriPrefix, 1);
 }
 
 /**
@@ -162,25 +154,12 @@ uint8_t	NDEF::encode_URI(uint8_t uriPrefix, uint8_t * msg){
  * @return              length of the encoded message
  */
 
-uint8_t NDEF::encode_TEXT(uint8_t * lang, uint8_t * msg){
-    uint8_t len = strlen((char *)msg);
-
-    uint8_t record_header = encode_record_header(1, 1, 0, 1, 0, NDEF_WELL_KNOWN_RECORD);
-   
-    uint8_t payload_head[9] = {0x03, len+7, record_header, 0x01, len+3, 0x54, 0x02, lang[0], lang[1]};
-    const uint8_t term[1] ={0xFE};
+uint16_t NDEF::encode_TEXT(uint8_t * lang, uint8_t * msg){
+    uint16_t len = strlen((char *)msg);
+    uint8_t type[1] = {NDEF_TYPE_TEXT};
+    uint8_t status[3] = {0x02, lang[0], lang[1]};
     
-    memmove(msg + 9, msg, len);
-    memcpy(msg, payload_head, 9);
-    memcpy(msg + 9 + len, term , 1);
-#ifdef DEBUG
-    for (uint8_t i = 0 ; i < len + 10; i++) {
-        Serial.print(msg[i], HEX);Serial.print(" ");
-    }
-    Serial.println("");
-#endif
-    
-    return len + 10;
+    return encode_message(msg, len, NDEF_WELL_KNOWN_RECORD, type, 1, status, 3);
 }
 
 /**
@@ -192,20 +171,67 @@ uint8_t NDEF::encode_TEXT(uint8_t * lang, uint8_t * msg){
  * @return              length of the encoded message
  */
 
-uint8_t NDEF::encode_MIME(uint8_t * mimetype, uint8_t * data, uint8_t len){
+uint16_t NDEF::encode_MIME(uint8_t * mimetype, uint8_t * data, uint16_t len){
     uint8_t typeLen = strlen((char *) mimetype);
     
-    uint8_t record_header = encode_record_header(1, 1, 0, 1, 0, NDEF_MIME_TYPE_RECORD);
-    
-    uint8_t payload_head[5] = {0x03, len + typeLen + 3, record_header, typeLen, len};
-    const uint8_t term[1] ={0xFE};
+    return encode_message(data, len, NDEF_MIME_TYPE_RECORD, mimetype, typeLen, 0, 0);
+}
 
-    memmove(data + 5 + typeLen, data, len);
-    memcpy(data, payload_head, 5);
-    memcpy(data + 5, mimetype, typeLen);
-    memcpy(data + 5 + typeLen + len,  term , 1);
+/**
+ * wraps the len bytes at the start of msg in a single record message TLV
+ * payloads over 255 bytes get a long record (SR=0), messages of 255 bytes and
+ * more a 3 byte TLV length
+ *
+ * @param msg           buffer holding the data, the header is inserted in front of it
+ * @param len           length of the data
+ * @param tnf           Type Name Field
+ * @param type          record type
+ * @param typeLength    length of the record type
+ * @param prefix        bytes starting the payload before the data (URI prefix, text status and lang)
+ * @param prefixLength  length of prefix
+ * @return              length of the encoded message
+ */
+
+uint16_t NDEF::encode_message(uint8_t * msg, uint16_t len, uint8_t tnf, uint8_t * type, uint8_t typeLength, uint8_t * prefix, uint8_t prefixLength){
+    uint16_t payloadLength = prefixLength + len;
+    bool sr = payloadLength < 256;
+    uint16_t recordLength = (sr ? 3 : 6) + typeLength + payloadLength;
+    uint8_t headLength = (recordLength < 0xFF ? 2 : 4) + (sr ? 3 : 6) + typeLength + prefixLength;
+    uint8_t * head = msg;
+    
+    memmove(msg + headLength, msg, len);
+    
+    *head++ = 0x03;
+    if (recordLength < 0xFF) {
+        *head++ = recordLength;
+    } else {
+        *head++ = 0xFF;
+        *head++ = recordLength >> 8;
+        *head++ = recordLength;
+    }
+    *head++ = encode_record_header(1, 1, 0, sr, 0, tnf);
+    *head++ = typeLength;
+    if (sr) {
+        *head++ = payloadLength;
+    } else {
+        *head++ = 0x00;
+        *head++ = 0x00;
+        *head++ = payloadLength >> 8;
+        *head++ = payloadLength;
+    }
+    memcpy(head, type, typeLength);
+    if (prefixLength)
+        memcpy(head + typeLength, prefix, prefixLength);
     
-    return typeLen + len + 6;
+    msg[headLength + len] = 0xFE;
+#ifdef DEBUG
+    for (uint16_t i = 0 ; i < headLength + len + 1; i++) {
+        Serial.print(msg[i], HEX);Serial.print(" ");
+    }
+    Serial.println("");
+#endif
+    
+    return headLength + len + 1;
 }
 
 /**
@@ -336,15 +362,21 @@ char * NDEF::get_uri_prefix(uint8_t b)
  *
  * @param payload      The NDEF URI payload
  * @param payload_len  The length of the NDEF URI payload
- * @return             The full reconstructed URI
+ * @param uri          The full reconstructed URI, truncated to NDEF_BUFFER_SIZE
+ * @return             Success or not.
  */
 bool NDEF::parse_uri(uint8_t * payload, int payload_len, char * uri ){
 	char * prefix = get_uri_prefix(payload[0]);
     int prefix_len = strlen(prefix);
+    int uri_len = payload_len - 1;
+    
+    // longer URIs are truncated to the buffer
+    if (prefix_len + uri_len >= NDEF_BUFFER_SIZE)
+        uri_len = NDEF_BUFFER_SIZE - 1 - prefix_len;
     
     memcpy(uri, prefix, prefix_len);
-    memcpy(uri + prefix_len, payload + 1, payload_len - 1);
-	*(uri + prefix_len + payload_len - 1) = 0x00;
+    memcpy(uri + prefix_len, payload + 1, uri_len);
+	*(uri + prefix_len + uri_len) = 0x00;
     
     return true;
 }
@@ -362,11 +394,152 @@ bool NDEF::parse_text(uint8_t * payload, int payload_len, char * lang, char * te
     memcpy(lang, payload + 1, 2);
     *(lang + 2) = 0x00;
     
+    // text can be payload itself
     const int text_len = payload_len - 3;
-    memcpy(text, payload + 3, text_len);
+    memmove(text, payload + 3, text_len);
     *(text + text_len) = 0x00;
     
     return true;
 }
 
 
+
+
+
+#define STREAM_HEADER           0
+#define STREAM_TYPE_LENGTH      1
+#define STREAM_PAYLOAD_LENGTH   2
+#define STREAM_ID_LENGTH        3
+#define STREAM_TYPE             4
+#define STREAM_ID               5
+#define STREAM_PAYLOAD          6
+#define STREAM_DONE             7
+#define STREAM_FAILED           8
+
+NDEF_Stream::NDEF_Stream(NDEF_RECORD_CALLBACK callback, void * context){
+    this->callback = callback;
+    this->context = context;
+    reset();
+}
+
+/**
+ * Gets ready to parse a new message
+ */
+void NDEF_Stream::reset(void){
+    state = STREAM_HEADER;
+    last = false;
+}
+
+/**
+ * true once the record flagged Message End has been parsed
+ */
+boolean NDEF_Stream::complete(void){
+    return state == STREAM_DONE;
+}
+
+/**
+ * true once feed met a record it can't parse, a chunked record, until reset
+ */
+boolean NDEF_Stream::failed(void){
+    return state == STREAM_FAILED;
+}
+
+/**
+ * Parses the next piece of the message. Record headers are assembled byte by
+ * byte, payload bytes are handed to the callback in place without copying.
+ *
+ * @param data      the next bytes of the message
+ * @param length    number of bytes in data
+ * @return          false if the message is malformed or holds a chunked
+ *                  record, failed() tells them apart
+ */
+boolean NDEF_Stream::feed(uint8_t * data, uint8_t length){
+    uint8_t i = 0;
+    
+    while (i < length) {
+        uint8_t b = data[i];
+        
+        switch (state) {
+            case STREAM_HEADER:
+                // chunked records aren't supported
+                if (b & 0x20) {
+                    state = STREAM_FAILED;
+                    return false;
+                }
+                record.header = b;
+                record.tnf = b & 0x07;
+                record.payloadLength = 0;
+                idLength = 0;
+                last = (b & 0x40) == 0x40;
+                state = STREAM_TYPE_LENGTH;
+                break;
+            case STREAM_TYPE_LENGTH:
+                record.typeLength = b;
+                // short records have a 1 byte payload length, others 4
+                count = (record.header & 0x10) ? 1 : 4;
+                state = STREAM_PAYLOAD_LENGTH;
+                break;
+            case STREAM_PAYLOAD_LENGTH:
+                record.payloadLength = (record.payloadLength << 8) | b;
+                if (--count == 0)
+                    state = (record.header & 0x08) ? STREAM_ID_LENGTH : STREAM_TYPE;
+                break;
+            case STREAM_ID_LENGTH:
+                idLength = b;
+                state = STREAM_TYPE;
+                break;
+            case STREAM_TYPE:
+                if (count < NDEF_STREAM_TYPE_SIZE)
+                    record.type[count] = b;
+                count++;
+                break;
+            case STREAM_ID:
+                // the record id is skipped
+                count++;
+                break;
+            case STREAM_PAYLOAD: {
+                uint32_t remaining = record.payloadLength - count;
+                uint8_t available = length - i;
+                uint8_t chunk = (available < remaining) ? available : remaining;
+                
+                callback(&record, data + i, chunk, count, context);
+                count += chunk;
+                i += chunk - 1;
+                break;
+            }
+            default:
+                // bytes after the last record, or after a record that failed
+                return false;
+        }
+        i++;
+        
+        // move past the fields that are complete, or empty
+        if (state == STREAM_TYPE && count == record.typeLength) {
+            state = STREAM_ID;
+            count = 0;
+        }
+        if (state == STREAM_ID && count == idLength) {
+            state = STREAM_PAYLOAD;
+            count = 0;
+            if (record.payloadLength == 0)
+                callback(&record, data + i, 0, 0, context);
+        }
+        if (state == STREAM_PAYLOAD && count == record.payloadLength)
+            state = last ? STREAM_DONE : STREAM_HEADER;
+    }
+    return true;
+}
+
+/**
+ * Block callback for Mifare::streamPayload, context is the NDEF_Stream
+ *
+ *      NDEF_Stream parser(on_record, 0);
+ *      mifare.streamPayload(NDEF_Stream::consume, &parser);
+ */
+boolean NDEF_Stream::consume(uint8_t * data, uint8_t length, uint16_t offset, uint16_t /* total */, void * context){
+    NDEF_Stream * stream = (NDEF_Stream *)context;
+    
+    if (offset == 0)
+        stream->reset();
+    return stream->feed(data, length);
+}
@@ -63,25 +63,46 @@
 #define NDEF_WELL_KNOWN_RECORD              (0x01)
 #define NDEF_MIME_TYPE_RECORD               (0x02)
 
-#define NDEF_BUFFER_SIZE 224
+#define NDEF_BUFFER_SIZE 224     // longest decoded URI
+#define NDEF_MIME_TYPE_SIZE 32
 //#define DEBUG
 
 struct FOUND_MESSAGE{
     int type;
     char * format;
     uint8_t * payload;
+    uint16_t length;
 };
 
+#define NDEF_STREAM_TYPE_SIZE 16
+
+// a record as seen by NDEF_Stream, type is truncated to NDEF_STREAM_TYPE_SIZE
+struct NDEF_RECORD{
+    uint8_t header;
+    uint8_t tnf;
+    uint8_t typeLength;
+    uint8_t type[NDEF_STREAM_TYPE_SIZE];
+    uint32_t payloadLength;
+};
+
+/*
+ called by NDEF_Stream for every piece of a record payload. offset is the
+ position of data in the payload, the record is complete once
+ offset + length == record->payloadLength
+ */
+typedef void (*NDEF_RECORD_CALLBACK)(NDEF_RECORD * record, uint8_t * data, uint8_t length, uint32_t offset, void * context);
+
 class NDEF{
   public:
     NDEF();
 	FOUND_MESSAGE decode_message(uint8_t * msg);
-	uint8_t	encode_URI(uint8_t uriPrefix, uint8_t * msg);
-    uint8_t encode_TEXT(uint8_t * lang, uint8_t * msg);
-    uint8_t encode_MIME(uint8_t * mimetype, uint8_t * data, uint8_t len);
+	uint16_t encode_URI(uint8_t uriPrefix, uint8_t * msg);
+    uint16_t encode_TEXT(uint8_t * lang, uint8_t * msg);
+    uint16_t encode_MIME(uint8_t * mimetype, uint8_t * data, uint16_t len);
 	
   private:
     uint8_t encode_record_header(bool mb, bool me, bool cf, bool sr, bool il, uint8_t tnf);
+    uint16_t encode_message(uint8_t * msg, uint16_t len, uint8_t tnf, uint8_t * type, uint8_t typeLength, uint8_t * prefix, uint8_t prefixLength);
         
 //    char * get_type_description(uint8_t b);
     char * get_uri_prefix(uint8_t b);
@@ -90,4 +111,31 @@ class NDEF{
 };
 
 
+/*
+ incremental NDEF message parser, fed a few bytes at a time (ie one read from
+ Mifare::streamPayload) so the message never has to be held in memory.
+ chunked records (CF flag) aren't supported: feed returns false and failed()
+ is true from the first one on.
+ */
+class NDEF_Stream{
+  public:
+    NDEF_Stream(NDEF_RECORD_CALLBACK callback, void * context);
+    void reset(void);
+    boolean feed(uint8_t * data, uint8_t length);
+    boolean complete(void);
+    boolean failed(void);
+    
+    static boolean consume(uint8_t * data, uint8_t length, uint16_t offset, uint16_t total, void * context);
+    
+  private:
+    NDEF_RECORD_CALLBACK callback;
+    void * context;
+    NDEF_RECORD record;
+    uint8_t state;
+    uint8_t idLength;
+    uint32_t count;
+    boolean last;
+};
+
+
 #endif
\ No newline at end of file
@@ -64,9 +64,42 @@
 #define PN532_COMMAND_TGRESPONSETOINITIATOR (0x90)
 #define PN532_COMMAND_TGGETTARGETSTATUS     (0x8A)
 
+// CIU registers, for ReadRegister and WriteRegister (RF tuning, timers)
+#define PN532_REG_CIU_MODE                  (0x6301)
+#define PN532_REG_CIU_TXMODE                (0x6302)
+#define PN532_REG_CIU_RXMODE                (0x6303)
+#define PN532_REG_CIU_TXCONTROL             (0x6304)   /* antenna driver pins TX1, TX2 */
+#define PN532_REG_CIU_TXAUTO                (0x6305)
+#define PN532_REG_CIU_TXSEL                 (0x6306)
+#define PN532_REG_CIU_RXSEL                 (0x6307)
+#define PN532_REG_CIU_RXTHRESHOLD           (0x6308)   /* MinLevel, CollLevel */
+#define PN532_REG_CIU_DEMOD                 (0x6309)
+#define PN532_REG_CIU_FELNFC1               (0x630A)
+#define PN532_REG_CIU_FELNFC2               (0x630B)
+#define PN532_REG_CIU_MIFNFC                (0x630C)
+#define PN532_REG_CIU_MANUALRCV             (0x630D)
+#define PN532_REG_CIU_TYPEB                 (0x630E)
+#define PN532_REG_CIU_GSNOFF                (0x6313)   /* N driver conductance, modulation off */
+#define PN532_REG_CIU_MODWIDTH              (0x6314)   /* Miller pulse width */
+#define PN532_REG_CIU_TXBITPHASE            (0x6315)
+#define PN532_REG_CIU_RFCFG                 (0x6316)   /* RxGain in bits 4..6 */
+#define PN532_REG_CIU_GSNON                 (0x6317)   /* N driver conductance, modulation on */
+#define PN532_REG_CIU_CWGSP                 (0x6318)   /* P driver conductance, carrier */
+#define PN532_REG_CIU_MODGSP                (0x6319)   /* P driver conductance, modulation */
+#define PN532_REG_CIU_TMODE                 (0x631A)
+#define PN532_REG_CIU_TPRESCALER            (0x631B)
+#define PN532_REG_CIU_TRELOADVAL_HI         (0x631C)
+#define PN532_REG_CIU_TRELOADVAL_LO         (0x631D)
+#define PN532_REG_CIU_TCOUNTERVAL_HI        (0x631E)
+#define PN532_REG_CIU_TCOUNTERVAL_LO        (0x631F)
+#define PN532_REG_CIU_VERSION               (0x6327)
+#define PN532_REG_CIU_STATUS1               (0x6337)
+#define PN532_REG_CIU_STATUS2               (0x6338)
+
 
 
 #define PN532_PACKBUFFSIZE                  (32)
+#define PN532_FRAMESIZE                     (255)   /* longest frame a transport moves, LEN is one byte */
 
 //#define PN532DEBUG 1
 
@@ -77,9 +110,14 @@ public:
     virtual uint32_t    getFirmwareVersion(void);
     virtual boolean     readack(void);
     virtual boolean     sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    virtual boolean     sendCommandAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    virtual boolean     waitready(uint16_t timeout = 1000);
 	virtual uint8_t		readstatus(void);
     virtual void		readdata(uint8_t* buff, uint8_t n);
     virtual void		sendcommand(uint8_t* cmd, uint8_t cmdlen);
+    // longest cmd for sendcommand and n for readdata in one bus transfer
+    virtual uint8_t     commandlimit(void) { return PN532_FRAMESIZE - 1; }
+    virtual uint8_t     responselimit(void) { return PN532_FRAMESIZE; }
 };
 
 #endif
\ No newline at end of file
@@ -113,18 +113,33 @@ boolean PN532_I2C::readack(void) {
 /**************************************************************************/
 // default timeout of one second
 boolean PN532_I2C::sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout) {
-    uint16_t timer = 0;
+    return sendCommandAck(cmd, cmdlen, timeout);
+}
+
+/**************************************************************************/
+/*!
+ @brief  Sends a command and returns as soon as the ACK frame is read,
+ while the PN532 is still working on the command. Call waitready before
+ reading the response.
+ 
+ @param  cmd       Pointer to the command buffer
+ @param  cmdlen    The size of the command in bytes
+ @param  timeout   ms before giving up
+ 
+ @returns  1 if everything is OK, 0 if timeout occured before an
+ ACK was recieved
+ */
+/**************************************************************************/
+boolean PN532_I2C::sendCommandAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout) {
+    unsigned long start = millis();
     
     // write the command
     sendcommand(cmd, cmdlen);
     
     // Wait for chip to say its ready!
     while (readstatus() != PN532_READY) {
-        if (timeout != 0) {
-            timer+=10;
-            if (timer > timeout)
-                return false;
-        }
+        if (timeout != 0 && millis() - start > timeout)
+            return false;
         delay(80);
     }
     
@@ -143,6 +158,27 @@ boolean PN532_I2C::sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t ti
     return true; // ack'd command
 }
 
+/**************************************************************************/
+/*!
+ @brief  Waits for the response of the last command, polling the IRQ line
+ about every millisecond
+ 
+ @param  timeout   ms before giving up, 0 to wait forever
+ 
+ @returns  1 if the response is ready, 0 on timeout
+ */
+/**************************************************************************/
+boolean PN532_I2C::waitready(uint16_t timeout) {
+    unsigned long start = millis();
+    
+    while (readstatus() != PN532_READY) {
+        if (timeout != 0 && millis() - start > timeout)
+            return false;
+        delay(1);
+    }
+    return true;
+}
+
 
 
 /**************************************************************************/
@@ -270,6 +306,27 @@ void PN532_I2C::sendcommand(uint8_t* cmd, uint8_t cmdlen) {
 #endif
 }
 
+/**************************************************************************/
+/*!
+ @brief  Longest command sendcommand writes in one Wire transaction:
+ the Wire buffer less the preamble, start codes, LEN, LCS, TFI,
+ checksum and postamble
+ */
+/**************************************************************************/
+uint8_t PN532_I2C::commandlimit(void) {
+    return (PN532_I2C_BUFFSIZE - 8 < PN532_FRAMESIZE - 1) ? PN532_I2C_BUFFSIZE - 8 : PN532_FRAMESIZE - 1;
+}
+
+/**************************************************************************/
+/*!
+ @brief  Longest response readdata gets in one requestFrom: the Wire
+ buffer less the leading status byte and the byte requested past it
+ */
+/**************************************************************************/
+uint8_t PN532_I2C::responselimit(void) {
+    return (PN532_I2C_BUFFSIZE - 2 < PN532_FRAMESIZE) ? PN532_I2C_BUFFSIZE - 2 : PN532_FRAMESIZE;
+}
+
 /**************************************************************************/
 /*!
  @brief  Sends a single byte via I2C
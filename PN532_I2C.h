@@ -19,6 +19,11 @@
 #define PN532_I2C_ADDRESS                   (0x48 >> 1)
 #define PN532_I2C_READBIT                   (0x01)
 #define PN532_I2C_READYTIMEOUT              (20)
+#ifdef BUFFER_LENGTH
+#define PN532_I2C_BUFFSIZE                  (BUFFER_LENGTH)   /* the Wire buffer, 32 bytes on AVR */
+#else
+#define PN532_I2C_BUFFSIZE                  (32)
+#endif
 
 
 class PN532_I2C : public PN532{
@@ -30,10 +35,14 @@ public:
     boolean readack(void);
     
     boolean sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean sendCommandAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean waitready(uint16_t timeout = 1000);
     
 	uint8_t readstatus(void);
 	void    readdata(uint8_t* buffer, uint8_t length);
     void    sendcommand(uint8_t* cmd, uint8_t cmdlen);
+    uint8_t commandlimit(void);
+    uint8_t responselimit(void);
 	
 private:
     uint8_t _irq, _reset;
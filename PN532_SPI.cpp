@@ -120,37 +120,64 @@ boolean PN532_SPI::readack() {
 
 // default timeout of one second
 boolean PN532_SPI::sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout) {
-    uint16_t timer = 0;
+    if (!sendCommandAck(cmd, cmdlen, timeout))
+        return false;
+    
+    // Wait for chip to say its ready!
+    return waitready(timeout);
+}
+
+/**************************************************************************/
+/*!
+ @brief  Sends a command and returns as soon as the ACK frame is read,
+ while the PN532 is still working on the command. Call waitready before
+ reading the response.
+ 
+ @param  cmd       Pointer to the command buffer
+ @param  cmdlen    The size of the command in bytes
+ @param  timeout   ms before giving up
+ 
+ @returns  1 if everything is OK, 0 if timeout occured before an
+ ACK was recieved
+ */
+/**************************************************************************/
+
+boolean PN532_SPI::sendCommandAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout) {
+    unsigned long start = millis();
     
     // write the command
     sendcommand(cmd, cmdlen);
     
     // Wait for chip to say its ready!
     while (readstatus() != PN532_READY) {
-        if (timeout != 0) {
-            timer+=10;
-            if (timer > timeout)
-                return false;
-        }
+        if (timeout != 0 && millis() - start > timeout)
+            return false;
         delay(10);
     }
     
     // read acknowledgement
-    if (!readack()) {
-        return false;
-    }
+    return readack();
+}
+
+/**************************************************************************/
+/*!
+ @brief  Waits for the response of the last command, polling the status
+ byte about every 3 ms (readstatus takes 2)
+ 
+ @param  timeout   ms before giving up, 0 to wait forever
+ 
+ @returns  1 if the response is ready, 0 on timeout
+ */
+/**************************************************************************/
+
+boolean PN532_SPI::waitready(uint16_t timeout) {
+    unsigned long start = millis();
     
-    timer = 0;
-    // Wait for chip to say its ready!
     while (readstatus() != PN532_READY) {
-        if (timeout != 0) {
-            timer+=10;
-            if (timer > timeout)
-                return false;
-        }
-        delay(10);
+        if (timeout != 0 && millis() - start > timeout)
+            return false;
+        delay(1);
     }
-    
     return true;
 }
 
@@ -30,6 +30,8 @@ public:
     boolean readack(void);
 
     boolean sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean sendCommandAck(uint8_t *cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean waitready(uint16_t timeout = 1000);
     
 	uint8_t readstatus(void);
     void    readdata(uint8_t* buffer, uint8_t length);
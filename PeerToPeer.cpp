@@ -0,0 +1,351 @@
+/**************************************************************************/
+/*! 
+	@file     PeerToPeer.cpp
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#include "PeerToPeer.h"
+
+PeerToPeer::PeerToPeer(PN532 * pn532){
+    this->pn532 = pn532;
+    role = P2P_ROLE_NONE;
+    tg = 0;
+    chunkSize = 0;
+}
+
+
+/**************************************************************************/
+/*!
+ Activates a target in passive mode at 106 kbps with InJumpForDEP, then
+ switches both sides to baudRate with InPSL. Passive 106 kbps is what
+ every target answers, the PSL gets the rate up for the transfer.
+ 
+ @param  baudRate   P2P_106, P2P_212 or P2P_424
+ @param  timeout    ms to wait for a target, 0 waits forever
+ 
+ @returns true once the link runs at baudRate
+ */
+/**************************************************************************/
+boolean PeerToPeer::initiate(uint8_t baudRate, uint16_t timeout){
+    role = P2P_ROLE_NONE;
+    
+    packetbuffer[0] = PN532_COMMAND_INJUMPFORDEP;
+    packetbuffer[1] = 0x00;     // passive
+    packetbuffer[2] = P2P_106;
+    packetbuffer[3] = 0x00;     // no NFCID3i or general bytes
+    
+    if (! pn532->sendCommandAck(packetbuffer, 4))
+        return false;
+    if (! pn532->waitready(timeout))
+        return false;
+    
+    /* response: status, Tg, ATR_RES without its command bytes
+    
+     byte            Description
+     -------------   ------------------------------------------
+     b7              status
+     b8              Tg
+     b9..18          NFCID3t
+     b19..22         DIDt, BSt, BRt, TO
+     b23             PPt, LR in bits 4..5 */
+    pn532->readdata(packetbuffer, 26);
+    if ((packetbuffer[6] != PN532_COMMAND_INJUMPFORDEP + 1) || ((packetbuffer[7] & 0x3F) != 0x00))
+        return false;
+    
+    tg = packetbuffer[8];
+    setChunkSize(packetbuffer[23]);
+    
+    if (baudRate != P2P_106) {
+        packetbuffer[0] = PN532_COMMAND_INPSL;
+        packetbuffer[1] = tg;
+        packetbuffer[2] = baudRate;     // initiator to target
+        packetbuffer[3] = baudRate;     // target to initiator
+    
+        if (! pn532->sendCommandCheckAck(packetbuffer, 4))
+            return false;
+        pn532->readdata(packetbuffer, 10);
+        if ((packetbuffer[6] != PN532_COMMAND_INPSL + 1) || ((packetbuffer[7] & 0x3F) != 0x00)) {
+            release();
+            return false;
+        }
+    }
+    
+#ifdef P2PDEBUG
+    Serial.print("DEP target "); Serial.print(tg, DEC);
+    Serial.print(", chunks of "); Serial.println(chunkSize, DEC);
+#endif
+    role = P2P_ROLE_INITIATOR;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Waits for an initiator as a DEP only target with TgInitAsTarget. A PSL
+ from the initiator is answered by the PN532.
+ 
+ @param  timeout    ms to wait for an initiator, 0 waits forever
+ 
+ @returns true once an initiator activated the PN532, false at once when
+ the transport can't write TgInitAsTarget
+ */
+/**************************************************************************/
+boolean PeerToPeer::listen(uint16_t timeout){
+    // mode, MIFARE params, FeliCa params, NFCID3t, no general or historical bytes
+    static const uint8_t initAsTarget[] = {
+        PN532_COMMAND_TGINITASTARGET, 0x02,
+        0x04, 0x00, 0x12, 0x34, 0x56, 0x40,
+        0x01, 0xFE, 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF,
+        0x01, 0xFE, 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0x00, 0x00,
+        0x00, 0x00};
+    
+    role = P2P_ROLE_NONE;
+    if (sizeof(initAsTarget) > pn532->commandlimit())
+        return false;
+    memcpy(packetbuffer, initAsTarget, sizeof(initAsTarget));
+    
+    if (! pn532->sendCommandAck(packetbuffer, sizeof(initAsTarget)))
+        return false;
+    if (! pn532->waitready(timeout))
+        return false;
+    
+    // response: mode, then the ATR_REQ with its length byte, PPi is b24
+    pn532->readdata(packetbuffer, 27);
+    if (packetbuffer[6] != PN532_COMMAND_TGINITASTARGET + 1 || packetbuffer[9] != 0xD4 || packetbuffer[10] != 0x00)
+        return false;
+    
+    setChunkSize(packetbuffer[24]);
+    
+#ifdef P2PDEBUG
+    Serial.print("DEP initiator, mode 0x"); Serial.print(packetbuffer[7], HEX);
+    Serial.print(", chunks of "); Serial.println(chunkSize, DEC);
+#endif
+    role = P2P_ROLE_TARGET;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Sends a message to the peer. The initiator sends it in chunks, each one
+ answered by the target, the target hands a chunk to every P2P_PULL.
+ 
+ @param  data     the message
+ @param  length   its length, 0 sends an empty message
+ 
+ @returns false if the link fails or the peer stops the transfer
+ */
+/**************************************************************************/
+boolean PeerToPeer::send(const uint8_t * data, uint32_t length){
+    uint32_t offset = 0;
+    
+    do {
+        uint8_t n = (length - offset < chunkSize) ? length - offset : chunkSize;
+        boolean last = (offset + n == length);
+    
+        if (role == P2P_ROLE_INITIATOR) {
+            packetbuffer[2] = last ? P2P_DATA_END : P2P_DATA;
+            memcpy(packetbuffer + 3, data + offset, n);
+            if (exchange(n + 1) == 0 || packetbuffer[8] != P2P_ACK)
+                return false;
+        } else if (role == P2P_ROLE_TARGET) {
+            uint8_t received = getData();
+            if (received == 0 || packetbuffer[8] != P2P_PULL)
+                return false;
+            // the pull carries the longest chunk the initiator reads
+            if (received > 1 && packetbuffer[9] != 0 && packetbuffer[9] < n) {
+                n = packetbuffer[9];
+                last = false;
+            }
+            packetbuffer[1] = last ? P2P_END : P2P_MORE;
+            memcpy(packetbuffer + 2, data + offset, n);
+            if (!setData(n + 1))
+                return false;
+        } else {
+            return false;
+        }
+        offset += n;
+    } while (offset < length);
+    
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Receives a message from the peer, chunk by chunk
+ 
+ @param  callback   called for every chunk, returns false to stop
+ @param  context    passed to callback
+ @param  length     set to the message length, can be 0
+ 
+ @returns false if the link fails or the callback stops the transfer. A
+ target stopping sends P2P_NAK, an initiator stopping pulls no more so the
+ target's send times out.
+ */
+/**************************************************************************/
+boolean PeerToPeer::receive(P2P_CHUNK_CALLBACK callback, void * context, uint32_t * length){
+    uint32_t offset = 0;
+    boolean last = false;
+    
+    while (!last) {
+        uint8_t received;
+    
+        if (role == P2P_ROLE_INITIATOR) {
+            packetbuffer[2] = P2P_PULL;
+            packetbuffer[3] = chunkSize;
+            received = exchange(2);
+            if (received == 0 || (packetbuffer[8] != P2P_MORE && packetbuffer[8] != P2P_END))
+                return false;
+            last = (packetbuffer[8] == P2P_END);
+            if (received > 1 && !callback(packetbuffer + 9, received - 1, offset, context))
+                return false;
+        } else if (role == P2P_ROLE_TARGET) {
+            received = getData();
+            if (received == 0 || (packetbuffer[8] != P2P_DATA && packetbuffer[8] != P2P_DATA_END))
+                return false;
+            last = (packetbuffer[8] == P2P_DATA_END);
+            boolean taken = (received == 1) || callback(packetbuffer + 9, received - 1, offset, context);
+            packetbuffer[1] = taken ? P2P_ACK : P2P_NAK;
+            if (!setData(1) || !taken)
+                return false;
+        } else {
+            return false;
+        }
+        offset += received - 1;
+    }
+    
+    if (length)
+        *length = offset;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Ends the link. The initiator releases the target with InRelease, a
+ target only forgets it, the next listen waits for a new initiator.
+ */
+/**************************************************************************/
+boolean PeerToPeer::release(void){
+    uint8_t was = role;
+    
+    role = P2P_ROLE_NONE;
+    if (was != P2P_ROLE_INITIATOR)
+        return true;
+    
+    packetbuffer[0] = PN532_COMMAND_INRELEASE;
+    packetbuffer[1] = tg;
+    if (! pn532->sendCommandCheckAck(packetbuffer, 2))
+        return false;
+    pn532->readdata(packetbuffer, 10);
+    return (packetbuffer[6] == PN532_COMMAND_INRELEASE + 1) && ((packetbuffer[7] & 0x3F) == 0x00);
+}
+
+
+/*
+ P2P_ROLE_INITIATOR or P2P_ROLE_TARGET while linked, P2P_ROLE_NONE otherwise
+ */
+uint8_t PeerToPeer::getRole(void){
+    return role;
+}
+
+
+/*
+ message bytes per DEP frame on this link
+ */
+uint8_t PeerToPeer::getChunkSize(void){
+    return chunkSize;
+}
+
+
+/*
+ longest response read into packetbuffer: its size, or less when the
+ transport reads shorter frames
+ */
+uint8_t PeerToPeer::frameSize(void){
+    uint8_t limit = pn532->responselimit();
+    return (limit < P2P_BUFFSIZE) ? limit : P2P_BUFFSIZE;
+}
+
+
+/*
+ InDataExchange of the payload at packetbuffer[2], the response payload
+ replaces it from packetbuffer[8]. returns its length, 0 if it fails
+ */
+uint8_t PeerToPeer::exchange(uint8_t length){
+    packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
+    packetbuffer[1] = tg;
+    
+    if (! pn532->sendCommandAck(packetbuffer, length + 2))
+        return 0;
+    if (! pn532->waitready(P2P_TIMEOUT))
+        return 0;
+    uint8_t frame = frameSize();
+    pn532->readdata(packetbuffer, frame);
+    
+    if ((packetbuffer[6] != PN532_COMMAND_INDATAEXCHANGE + 1) || ((packetbuffer[7] & 0x3F) != 0x00))
+        return 0;
+    if (packetbuffer[3] < 4 || packetbuffer[3] + 7 > frame)
+        return 0;
+    return packetbuffer[3] - 3;
+}
+
+
+/*
+ TgGetData, the initiator's payload is put at packetbuffer[8]. returns its
+ length, 0 if it fails or the initiator released the link
+ */
+uint8_t PeerToPeer::getData(void){
+    packetbuffer[0] = PN532_COMMAND_TGGETDATA;
+    
+    if (! pn532->sendCommandAck(packetbuffer, 1))
+        return 0;
+    if (! pn532->waitready(P2P_TIMEOUT))
+        return 0;
+    uint8_t frame = frameSize();
+    pn532->readdata(packetbuffer, frame);
+    
+    if ((packetbuffer[6] != PN532_COMMAND_TGGETDATA + 1) || ((packetbuffer[7] & 0x3F) != 0x00))
+        return 0;
+    if (packetbuffer[3] < 4 || packetbuffer[3] + 7 > frame)
+        return 0;
+    return packetbuffer[3] - 3;
+}
+
+
+/*
+ TgSetData of the payload at packetbuffer[1], the answer to the last
+ TgGetData
+ */
+boolean PeerToPeer::setData(uint8_t length){
+    packetbuffer[0] = PN532_COMMAND_TGSETDATA;
+    
+    if (! pn532->sendCommandCheckAck(packetbuffer, length + 1))
+        return false;
+    pn532->readdata(packetbuffer, 10);
+    return (packetbuffer[6] == PN532_COMMAND_TGSETDATA + 1) && ((packetbuffer[7] & 0x3F) == 0x00);
+}
+
+
+/*
+ chunk size from the PP byte of ATR_REQ or ATR_RES: LR in bits 4..5 is
+ the transport data limit (64, 128, 192 or 254 bytes), less the DEP
+ header (CMD0, CMD1, PFB) and the chunk header. it is also kept to what
+ the host frames hold: a response frame takes 11 bytes besides the chunk,
+ an InDataExchange command 3.
+ */
+void PeerToPeer::setChunkSize(uint8_t pp){
+    uint8_t lr = ((pp >> 4) & 0x03) == 0x03 ? 254 : 64 * (((pp >> 4) & 0x03) + 1);
+    
+    chunkSize = lr - 4;
+    if (chunkSize > P2P_CHUNKSIZE)
+        chunkSize = P2P_CHUNKSIZE;
+    if (chunkSize > frameSize() - 11)
+        chunkSize = frameSize() - 11;
+    if (chunkSize > pn532->commandlimit() - 3)
+        chunkSize = pn532->commandlimit() - 3;
+}
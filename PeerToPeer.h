@@ -0,0 +1,88 @@
+/**************************************************************************/
+/*! 
+	@file     PeerToPeer.h
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#ifndef __PEERTOPEER_INCLUDED__
+#define __PEERTOPEER_INCLUDED__
+
+#include "PN532_Com.h"
+
+// baud rates of InJumpForDEP and InPSL
+#define P2P_106     0x00
+#define P2P_212     0x01
+#define P2P_424     0x02
+
+#ifndef P2P_BUFFSIZE
+#define P2P_BUFFSIZE    64      /* frames to and from the PN532, up to 255 on boards with the RAM */
+#endif
+#define P2P_CHUNKSIZE   (P2P_BUFFSIZE - 11)     /* frame header, status, chunk header, checksum, postamble */
+#define P2P_TIMEOUT     1000    /* ms to wait for the peer's next chunk */
+
+// chunk headers, the first byte of every DEP payload
+#define P2P_DATA        0x01    /* initiator data, more follows */
+#define P2P_DATA_END    0x02    /* last chunk of initiator data */
+#define P2P_PULL        0x03    /* initiator asks for the next chunk of target data, up to the size that follows */
+#define P2P_ACK         0x04    /* target took the chunk */
+#define P2P_NAK         0x05    /* target stopped the transfer */
+#define P2P_MORE        0x06    /* target data, more follows */
+#define P2P_END         0x07    /* last chunk of target data */
+
+#define P2P_ROLE_NONE       0
+#define P2P_ROLE_INITIATOR  1
+#define P2P_ROLE_TARGET     2
+
+//#define P2PDEBUG 1
+
+/*
+ called by PeerToPeer::receive for every chunk of a message, offset is the
+ position of data in the message. return false to stop the transfer.
+ */
+typedef boolean (*P2P_CHUNK_CALLBACK)(uint8_t * data, uint8_t length, uint32_t offset, void * context);
+
+/*
+ Moves messages of any length between two PN532s over NFC-DEP, one the
+ initiator, the other the target. DEP is request and response, the
+ initiator drives every exchange: it sends its messages chunk by chunk,
+ each answered with P2P_ACK, and pulls the target's messages chunk by
+ chunk with P2P_PULL. Both sides call send and receive in the same order.
+
+ Chunks fill the host frame (P2P_BUFFSIZE, or less when the transport
+ moves shorter frames, see PN532::responselimit) but never the LR negotiated
+ in ATR_REQ/ATR_RES, so each one is a single DEP frame and the PN532 doesn't
+ chain it. Every P2P_PULL carries the initiator's chunk size, the target
+ never answers with more. TgInitAsTarget takes a 38 byte command, so the
+ target needs a transport that writes one (not I2C with the AVR Wire
+ buffer).
+ */
+class PeerToPeer{
+  public:
+    PeerToPeer(PN532 * pn532);
+    
+    boolean initiate(uint8_t baudRate = P2P_424, uint16_t timeout = 0);
+    boolean listen(uint16_t timeout = 0);
+    boolean send(const uint8_t * data, uint32_t length);
+    boolean receive(P2P_CHUNK_CALLBACK callback, void * context, uint32_t * length);
+    boolean release(void);
+    
+    uint8_t getRole(void);
+    uint8_t getChunkSize(void);
+    
+  private:
+    PN532 * pn532;
+    uint8_t role;
+    uint8_t tg;
+    uint8_t chunkSize;
+    uint8_t packetbuffer[P2P_BUFFSIZE];
+    
+    uint8_t frameSize(void);
+    uint8_t exchange(uint8_t length);
+    uint8_t getData(void);
+    boolean setData(uint8_t length);
+    void setChunkSize(uint8_t pp);
+};
+
+#endif
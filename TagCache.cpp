@@ -0,0 +1,166 @@
+/**************************************************************************/
+/*! 
+	@file     TagCache.cpp
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#include "TagCache.h"
+
+TagCache::TagCache(){
+    clear();
+}
+
+
+/**************************************************************************/
+/*!
+ Returns the decoded NDEF message of the session's tag. A cached tag whose
+ fingerprint still matches costs one exchange (an authentication and a
+ READ on classic), otherwise the message is read into buffer, decoded and
+ cached.
+ 
+ @param  mifare       reader holding the session
+ @param  session      session of the tag to read
+ @param  buffer       buffer for the message when it has to be read
+ @param  bufferSize   size of buffer
+ @param  message      receives the decoded message, it points into the
+ cache or into buffer
+ 
+ @returns false if the tag couldn't be read
+ */
+/**************************************************************************/
+boolean TagCache::readMessage(Mifare & mifare, MIFARE_SESSION * session, uint8_t * buffer, uint16_t bufferSize, FOUND_MESSAGE * message){
+    TAGCACHE_ENTRY * entry = find(&session->target);
+    uint8_t block = entry ? entry->block : 0;
+    uint16_t fingerprint;
+    
+    if (!mifare.readFingerprint(session, &fingerprint, &block))
+        return false;
+    
+    if (lookup(&session->target, fingerprint, message)){
+        hits++;
+        return true;
+    }
+    misses++;
+    
+    if (!mifare.readPayload(session, buffer, bufferSize)){
+        forget(&session->target);
+        return false;
+    }
+    *message = NDEF().decode_message(buffer);
+    store(&session->target, fingerprint, message, block);
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Looks up the message cached for target
+ 
+ @returns true and fills message if the tag is cached with the same
+ fingerprint
+ */
+/**************************************************************************/
+boolean TagCache::lookup(MIFARE_TARGET * target, uint16_t fingerprint, FOUND_MESSAGE * message){
+    TAGCACHE_ENTRY * entry = find(target);
+    
+    if (!entry || entry->fingerprint != fingerprint)
+        return false;
+    
+    entry->lastUsed = ++clock;
+    message->type = entry->type;
+    message->format = entry->format;
+    message->payload = entry->payload;
+    message->length = entry->length;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Caches a decoded message for target, replacing the least recently used
+ entry. Messages whose payload or format doesn't fit aren't cached. block
+ is the classic block the fingerprint was read from, see
+ Mifare::readFingerprint.
+ */
+/**************************************************************************/
+void TagCache::store(MIFARE_TARGET * target, uint16_t fingerprint, FOUND_MESSAGE * message, uint8_t block){
+    TAGCACHE_ENTRY * entry = find(target);
+    
+    if (message->type == 0 || message->length >= TAGCACHE_PAYLOAD_SIZE){
+        if (entry)
+            entry->uidLength = 0;
+        return;
+    }
+    
+    if (!entry){
+        entry = &entries[0];
+        for (uint8_t i = 1; i < TAGCACHE_ENTRIES; i++){
+            if (entries[i].uidLength == 0 || (entry->uidLength != 0 && entries[i].lastUsed < entry->lastUsed))
+                entry = &entries[i];
+        }
+    }
+    
+    // URI records keep their prefix code in format, the others a string
+    if (message->type == NDEF_TYPE_URI){
+        entry->format = message->format;
+    }else{
+        if (strlen(message->format) >= TAGCACHE_FORMAT_SIZE){
+            entry->uidLength = 0;
+            return;
+        }
+        strcpy(entry->formatBuffer, message->format);
+        entry->format = entry->formatBuffer;
+    }
+    
+    entry->uidLength = target->uidLength;
+    memcpy(entry->uid, target->uid, target->uidLength);
+    entry->fingerprint = fingerprint;
+    entry->block = block;
+    entry->lastUsed = ++clock;
+    entry->type = message->type;
+    entry->length = message->length;
+    memcpy(entry->payload, message->payload, message->length);
+    entry->payload[message->length] = 0x00;
+    
+    // serve the cached copy, decoded messages point into shared buffers
+    message->format = entry->format;
+    message->payload = entry->payload;
+}
+
+
+/**************************************************************************/
+/*!
+ Drops the entry of target, ie after writing to the tag
+ */
+/**************************************************************************/
+void TagCache::forget(MIFARE_TARGET * target){
+    TAGCACHE_ENTRY * entry = find(target);
+    
+    if (entry)
+        entry->uidLength = 0;
+}
+
+
+/**************************************************************************/
+/*!
+ Empties the cache and resets the hit and miss counters
+ */
+/**************************************************************************/
+void TagCache::clear(){
+    for (uint8_t i = 0; i < TAGCACHE_ENTRIES; i++)
+        entries[i].uidLength = 0;
+    clock = 0;
+    hits = 0;
+    misses = 0;
+}
+
+
+TAGCACHE_ENTRY * TagCache::find(MIFARE_TARGET * target){
+    for (uint8_t i = 0; i < TAGCACHE_ENTRIES; i++){
+        if (entries[i].uidLength == target->uidLength && memcmp(entries[i].uid, target->uid, target->uidLength) == 0)
+            return &entries[i];
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/**************************************************************************/
+/*! 
+	@file     TagCache.h
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#ifndef __TAGCACHE_INCLUDED__
+#define __TAGCACHE_INCLUDED__
+
+#include "Mifare.h"
+#include "NDEF.h"
+
+// every entry costs about TAGCACHE_PAYLOAD_SIZE + 39 bytes of RAM
+#define TAGCACHE_ENTRIES        4
+#define TAGCACHE_PAYLOAD_SIZE   48
+#define TAGCACHE_FORMAT_SIZE    16
+
+struct TAGCACHE_ENTRY{
+    uint8_t uidLength;              // 0 for an empty entry
+    uint8_t uid[10];
+    uint16_t fingerprint;
+    uint8_t block;                  // classic block the fingerprint is read from, 0 for none
+    uint32_t lastUsed;              // TagCache clock at the last use, 32 bits so it never wraps
+    int type;
+    char * format;                  // URI prefix code, or points to formatBuffer
+    char formatBuffer[TAGCACHE_FORMAT_SIZE];
+    uint16_t length;
+    uint8_t payload[TAGCACHE_PAYLOAD_SIZE];
+};
+
+/*
+ LRU cache of decoded NDEF messages keyed by tag UID. A tag presented again
+ is checked with Mifare::readFingerprint and served from the cache when the
+ fingerprint still matches. Entries keep the classic block the fingerprint
+ was read from, so a classic card presented again costs an authentication
+ and a READ instead of walking its MAD first.
+ */
+class TagCache{
+  public:
+    TagCache();
+    
+    boolean readMessage(Mifare & mifare, MIFARE_SESSION * session, uint8_t * buffer, uint16_t bufferSize, FOUND_MESSAGE * message);
+    
+    boolean lookup(MIFARE_TARGET * target, uint16_t fingerprint, FOUND_MESSAGE * message);
+    void store(MIFARE_TARGET * target, uint16_t fingerprint, FOUND_MESSAGE * message, uint8_t block = 0);
+    void forget(MIFARE_TARGET * target);
+    void clear(void);
+    
+    uint16_t hits;
+    uint16_t misses;
+    
+  private:
+    TAGCACHE_ENTRY entries[TAGCACHE_ENTRIES];
+    uint32_t clock;
+    
+    TAGCACHE_ENTRY * find(MIFARE_TARGET * target);
+};
+
+#endif
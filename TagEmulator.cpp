@@ -0,0 +1,271 @@
+/**************************************************************************/
+/*! 
+	@file     TagEmulator.cpp
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#include "TagEmulator.h"
+
+TagEmulator::TagEmulator(PN532 * pn532){
+    this->pn532 = pn532;
+    message = 0;
+    fileSize = 0;
+    apduCount = 0;
+    selected = false;
+    file = EMULATOR_FILE_NONE;
+    served = false;
+}
+
+
+/**************************************************************************/
+/*!
+ Lets the PN532 answer RATS and handle ISO14443-4 blocks as a target, the
+ host only sees APDUs. Call after SAMConfig.
+ */
+/**************************************************************************/
+boolean TagEmulator::begin(void){
+    packetbuffer[0] = PN532_COMMAND_SETPARAMETERS;
+    packetbuffer[1] = 0x24;     // fAutomaticATR_RES, fISO14443-4_PICC
+    
+    if (! pn532->sendCommandCheckAck(packetbuffer, 2))
+        return false;
+    pn532->readdata(packetbuffer, 8);
+    return (packetbuffer[6] == PN532_COMMAND_SETPARAMETERS + 1);
+}
+
+
+/**************************************************************************/
+/*!
+ Sets the message to present. The image stays with the application and
+ must not change while it is emulated.
+ 
+ @param  image    NDEF message TLV as written by NDEF::encode_URI etc
+ @param  length   length returned by the encoder
+ 
+ @returns false if image doesn't start with an NDEF message TLV
+ */
+/**************************************************************************/
+boolean TagEmulator::setMessage(const uint8_t * image, uint16_t length){
+    uint16_t messageLength;
+    uint8_t header;
+    
+    if (length < 2 || image[0] != 0x03)
+        return false;
+    if (image[1] == 0xFF) {
+        if (length < 4)
+            return false;
+        messageLength = (image[2] << 8) | image[3];
+        header = 4;
+    } else {
+        messageLength = image[1];
+        header = 2;
+    }
+    if (header + messageLength > length)
+        return false;
+    
+    message = image + header;
+    fileSize = messageLength + 2;
+    fileHeader[0] = messageLength >> 8;
+    fileHeader[1] = messageLength;
+    
+    // CCLEN, mapping version 2.0, MLe, MLc, NDEF file control TLV: E104, size, read only
+    static const uint8_t ccTemplate[15] = {0x00, 0x0F, 0x20, 0x00, 0x00, 0x00, 0x01, 0x04, 0x06, 0xE1, 0x04, 0x00, 0x00, 0x00, 0xFF};
+    memcpy(cc, ccTemplate, sizeof(cc));
+    cc[3] = 0;
+    cc[4] = maxLe();
+    cc[11] = fileSize >> 8;
+    cc[12] = fileSize;
+    return true;
+}
+
+
+/**************************************************************************/
+/*!
+ Waits for a reader with TgInitAsTarget and answers its APDUs until it
+ leaves or stops talking for EMULATOR_TIMEOUT ms
+ 
+ @param  timeout  ms to wait for a reader, 0 waits forever
+ 
+ @returns true if the reader read the whole NDEF file, false at once when
+ the transport can't write TgInitAsTarget
+ */
+/**************************************************************************/
+boolean TagEmulator::emulate(uint16_t timeout){
+    // PICC only, passive; SENS_RES, NFCID1t, SEL_RES ISO14443-4; no FeliCa, DEP or historical bytes
+    static const uint8_t initAsTarget[] = {
+        PN532_COMMAND_TGINITASTARGET, 0x05,
+        0x04, 0x00, 0x12, 0x34, 0x56, 0x20,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00};
+    
+    apduCount = 0;
+    selected = false;
+    file = EMULATOR_FILE_NONE;
+    served = false;
+    if (!message || sizeof(initAsTarget) > pn532->commandlimit())
+        return false;
+    
+    memcpy(packetbuffer, initAsTarget, sizeof(initAsTarget));
+    if (! pn532->sendCommandAck(packetbuffer, sizeof(initAsTarget)))
+        return false;
+    if (! pn532->waitready(timeout))
+        return false;
+    
+    pn532->readdata(packetbuffer, frameSize());
+    if (packetbuffer[6] != PN532_COMMAND_TGINITASTARGET + 1)
+        return false;
+    
+    // after the mode byte comes the RATS the PN532 answered, or the first APDU
+    uint8_t length = packetbuffer[3] - 3;
+    if (length > 0 && packetbuffer[8] == 0xE0)
+        length = 0;
+    
+    while (true) {
+        if (length == 0 && (length = getData()) == 0)
+            break;
+        if (!setData(respond(packetbuffer + 8, length)))
+            break;
+        apduCount++;
+        length = 0;
+    }
+    
+#ifdef EMULATORDEBUG
+    Serial.print("APDUs: "); Serial.print(apduCount, DEC);
+    Serial.println(served ? ", message read" : "");
+#endif
+    return served;
+}
+
+
+/*
+ answers one command APDU of the NDEF tag application. the response, data
+ and status word, replaces it from packetbuffer[1]. returns its length
+ */
+uint8_t TagEmulator::respond(uint8_t * apdu, uint8_t length){
+    static const uint8_t aid[7] = {0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01};
+    uint16_t sw = 0x6D00;   // instruction not supported
+    uint8_t n = 0;
+    
+    if (length < 4) {
+        sw = 0x6700;
+    } else if (apdu[1] == 0xA4 && apdu[2] == 0x04) {
+        // SELECT by name
+        selected = (length >= 12 && apdu[4] == 7 && memcmp(apdu + 5, aid, 7) == 0);
+        file = EMULATOR_FILE_NONE;
+        sw = selected ? 0x9000 : 0x6A82;
+    } else if (apdu[1] == 0xA4 && apdu[2] == 0x00) {
+        // SELECT by file identifier
+        uint16_t id = (length >= 7 && apdu[4] == 2) ? (apdu[5] << 8) | apdu[6] : 0;
+        file = !selected ? EMULATOR_FILE_NONE : (id == 0xE103) ? EMULATOR_FILE_CC : (id == 0xE104) ? EMULATOR_FILE_NDEF : EMULATOR_FILE_NONE;
+        sw = (file != EMULATOR_FILE_NONE) ? 0x9000 : 0x6A82;
+    } else if (apdu[1] == 0xB0) {
+        uint16_t offset = (apdu[2] << 8) | apdu[3];
+        uint16_t le = (length > 4 && apdu[4] != 0) ? apdu[4] : 256;
+        uint16_t size = (file == EMULATOR_FILE_CC) ? sizeof(cc) : fileSize;
+        
+        if (file == EMULATOR_FILE_NONE) {
+            sw = 0x6986;    // no current file
+        } else if (offset > size) {
+            sw = 0x6B00;
+        } else {
+            n = readBinary(offset, le);
+            sw = 0x9000;
+        }
+    } else if (apdu[1] == 0xD6) {
+        sw = 0x6982;        // UPDATE BINARY, the file is read only
+    }
+    
+    packetbuffer[1 + n] = sw >> 8;
+    packetbuffer[2 + n] = sw;
+    return n + 2;
+}
+
+
+/*
+ copies le bytes of the current file at offset to packetbuffer[1], at most
+ maxLe and what is left of the file. the NDEF file is NLEN followed
+ by the message, copied from the image as it is
+ */
+uint8_t TagEmulator::readBinary(uint16_t offset, uint16_t le){
+    uint16_t size = (file == EMULATOR_FILE_CC) ? sizeof(cc) : fileSize;
+    uint8_t * out = packetbuffer + 1;
+    
+    if (le > maxLe())
+        le = maxLe();
+    if (le > size - offset)
+        le = size - offset;
+    
+    if (file == EMULATOR_FILE_CC) {
+        memcpy(out, cc + offset, le);
+        return le;
+    }
+    
+    uint8_t n = le;
+    while (n > 0 && offset < 2) {
+        *out++ = fileHeader[offset++];
+        n--;
+    }
+    memcpy(out, message + offset - 2, n);
+    if (offset + n == fileSize)
+        served = true;
+    return le;
+}
+
+
+/*
+ READ BINARY data per response: TgSetData takes the data and SW1 SW2, in
+ packetbuffer and in what the transport writes at once
+ */
+uint8_t TagEmulator::maxLe(void){
+    uint8_t limit = pn532->commandlimit();
+    return ((limit < EMULATOR_BUFFSIZE) ? limit : EMULATOR_BUFFSIZE) - 3;
+}
+
+
+/*
+ longest frame read into packetbuffer: its size, or less when the
+ transport reads shorter frames
+ */
+uint8_t TagEmulator::frameSize(void){
+    uint8_t limit = pn532->responselimit();
+    return (limit < EMULATOR_BUFFSIZE) ? limit : EMULATOR_BUFFSIZE;
+}
+
+
+/*
+ TgGetData, the APDU is put at packetbuffer[8]. returns its length, 0 when
+ the reader left or went quiet
+ */
+uint8_t TagEmulator::getData(void){
+    packetbuffer[0] = PN532_COMMAND_TGGETDATA;
+    
+    if (! pn532->sendCommandAck(packetbuffer, 1))
+        return 0;
+    if (! pn532->waitready(EMULATOR_TIMEOUT))
+        return 0;
+    uint8_t frame = frameSize();
+    pn532->readdata(packetbuffer, frame);
+    
+    if ((packetbuffer[6] != PN532_COMMAND_TGGETDATA + 1) || ((packetbuffer[7] & 0x3F) != 0x00))
+        return 0;
+    if (packetbuffer[3] < 4 || packetbuffer[3] + 7 > frame)
+        return 0;
+    return packetbuffer[3] - 3;
+}
+
+
+/*
+ TgSetData of the response at packetbuffer[1]
+ */
+boolean TagEmulator::setData(uint8_t length){
+    packetbuffer[0] = PN532_COMMAND_TGSETDATA;
+    
+    if (! pn532->sendCommandCheckAck(packetbuffer, length + 1))
+        return false;
+    pn532->readdata(packetbuffer, 10);
+    return (packetbuffer[6] == PN532_COMMAND_TGSETDATA + 1) && ((packetbuffer[7] & 0x3F) == 0x00);
+}
@@ -0,0 +1,69 @@
+/**************************************************************************/
+/*! 
+	@file     TagEmulator.h
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#ifndef __TAGEMULATOR_INCLUDED__
+#define __TAGEMULATOR_INCLUDED__
+
+#include "PN532_Com.h"
+
+#ifndef EMULATOR_BUFFSIZE
+#define EMULATOR_BUFFSIZE   64      /* frames to and from the PN532, up to 255 on boards with the RAM */
+#endif
+#define EMULATOR_MLE        (EMULATOR_BUFFSIZE - 3)     /* READ BINARY data per response: TgSetData, data, SW1 SW2, see TagEmulator::maxLe */
+#define EMULATOR_TIMEOUT    1000    /* ms to wait for the reader's next APDU */
+
+#define EMULATOR_FILE_NONE  0
+#define EMULATOR_FILE_CC    1
+#define EMULATOR_FILE_NDEF  2
+
+//#define EMULATORDEBUG 1
+
+/*
+ Presents an NDEF message to phones and readers as an NFC Forum type 4
+ tag, with the PN532 in ISO14443-4 card emulation. The message is the
+ image written by NDEF::encode_URI, encode_TEXT or encode_MIME, kept in
+ RAM by the application: setMessage finds the message in its TLV once,
+ READ BINARY is answered by copying from it, the NDEF file's length
+ (NLEN) is the only part not in the image.
+
+ Each APDU costs one TgGetData and one TgSetData, the capability
+ container lets the reader read EMULATOR_MLE bytes per READ BINARY, or
+ less when the transport writes shorter frames (PN532::commandlimit).
+ TgInitAsTarget takes a 38 byte command, so emulation needs a transport
+ that writes one (not I2C with the AVR Wire buffer).
+ */
+class TagEmulator{
+  public:
+    TagEmulator(PN532 * pn532);
+    
+    boolean begin(void);
+    boolean setMessage(const uint8_t * image, uint16_t length);
+    boolean emulate(uint16_t timeout = 0);
+    
+    uint16_t apduCount;             // APDUs answered by the last emulate
+    
+  private:
+    PN532 * pn532;
+    const uint8_t * message;
+    uint8_t fileHeader[2];          // NLEN
+    uint16_t fileSize;              // NLEN and the message
+    uint8_t cc[15];
+    boolean selected;               // NDEF tag application
+    uint8_t file;
+    boolean served;                 // the last byte of the NDEF file was read
+    uint8_t packetbuffer[EMULATOR_BUFFSIZE];
+    
+    uint8_t respond(uint8_t * apdu, uint8_t length);
+    uint8_t readBinary(uint16_t offset, uint16_t le);
+    uint8_t maxLe(void);
+    uint8_t frameSize(void);
+    uint8_t getData(void);
+    boolean setData(uint8_t length);
+};
+
+#endif
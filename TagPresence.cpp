@@ -0,0 +1,122 @@
+/**************************************************************************/
+/*! 
+	@file     TagPresence.cpp
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#include "TagPresence.h"
+
+TagPresence::TagPresence(Mifare & mifare, TAGPRESENCE_CALLBACK callback, void * context){
+    this->mifare = &mifare;
+    this->callback = callback;
+    this->context = context;
+    session = 0;
+    presentInterval = TAGPRESENCE_PRESENT_INTERVAL;
+    absentInterval = TAGPRESENCE_ABSENT_INTERVAL;
+    presentEvents = false;
+    checkTime = 0;
+    lastCheck = 0;
+    lastSeen = 0;
+}
+
+
+/**************************************************************************/
+/*!
+ Limits the activation retries of InListPassiveTarget so polling an empty
+ field doesn't block, call after SAMConfig
+ */
+/**************************************************************************/
+boolean TagPresence::begin(void){
+    lastSeen = millis();
+    return mifare->setPassiveActivationRetries(TAGPRESENCE_RETRIES);
+}
+
+
+/**************************************************************************/
+/*!
+ Sets the check intervals in ms. Shorter intervals give lower latency and
+ leave less time for the application's own exchanges.
+ */
+/**************************************************************************/
+void TagPresence::setIntervals(uint16_t presentInterval, uint16_t absentInterval){
+    this->presentInterval = presentInterval;
+    this->absentInterval = absentInterval;
+}
+
+
+/*
+ TAGPRESENCE_PRESENT after every successful check, off by default
+ */
+void TagPresence::setPresentEvents(boolean enabled){
+    presentEvents = enabled;
+}
+
+
+/*
+ session of the tracked tag, 0 when the field is empty
+ */
+MIFARE_SESSION * TagPresence::getSession(void){
+    return session;
+}
+
+
+/**************************************************************************/
+/*!
+ Runs a check when its interval is due and raises the event it leads to
+ 
+ @returns the event raised, TAGPRESENCE_NONE if there was none
+ */
+/**************************************************************************/
+uint8_t TagPresence::update(void){
+    unsigned long now = millis();
+    
+    if (now - lastCheck < (session ? presentInterval : absentInterval))
+        return TAGPRESENCE_NONE;
+    lastCheck = now;
+    
+    if (!session){
+        session = mifare->detect(TAGPRESENCE_DETECT_TIMEOUT);
+        now = millis();
+        checkTime = now - lastCheck;
+        
+        if (!session){
+            lastSeen = now;
+            return TAGPRESENCE_NONE;
+        }
+        target = session->target;
+        return raise(TAGPRESENCE_ARRIVED, now);
+    }
+    
+    boolean present = mifare->checkPresence(session);
+    now = millis();
+    checkTime = now - lastCheck;
+    
+    if (present){
+        lastSeen = now;
+        return presentEvents ? raise(TAGPRESENCE_PRESENT, now) : TAGPRESENCE_NONE;
+    }
+    
+    // lets the PN532 drop the target, it may answer with an error
+    mifare->release(session);
+    session = 0;
+    return raise(TAGPRESENCE_DEPARTED, now);
+}
+
+
+uint8_t TagPresence::raise(uint8_t type, unsigned long now){
+    TAGPRESENCE_EVENT event;
+    
+    event.type = type;
+    event.session = session;
+    event.target = target;
+    event.time = now;
+    event.latency = now - lastSeen;
+    
+    if (type != TAGPRESENCE_PRESENT)
+        lastSeen = now;
+    if (callback)
+        callback(&event, context);
+    return type;
+}
@@ -0,0 +1,73 @@
+/**************************************************************************/
+/*! 
+	@file     TagPresence.h
+	@author   Odopod, a Nurun Company
+	@license  BSD
+*/
+/**************************************************************************/
+
+#ifndef __TAGPRESENCE_INCLUDED__
+#define __TAGPRESENCE_INCLUDED__
+
+#include "Mifare.h"
+
+#define TAGPRESENCE_NONE        0
+#define TAGPRESENCE_ARRIVED     1
+#define TAGPRESENCE_PRESENT     2
+#define TAGPRESENCE_DEPARTED    3
+
+#define TAGPRESENCE_PRESENT_INTERVAL    100     /* ms between checks of a present tag */
+#define TAGPRESENCE_ABSENT_INTERVAL     200     /* ms between polls of an empty field */
+#define TAGPRESENCE_RETRIES             2       /* InListPassiveTarget activation retries */
+#define TAGPRESENCE_DETECT_TIMEOUT      1000    /* ms, only reached when begin() wasn't called */
+
+struct TAGPRESENCE_EVENT{
+    uint8_t type;                   // TAGPRESENCE_ARRIVED etc
+    MIFARE_SESSION * session;       // 0 once the tag departed
+    MIFARE_TARGET target;           // copy of the tag, still valid after departure
+    unsigned long time;             // millis() when the event was raised
+    uint16_t latency;               // ms since the tag was last known to be in the other state
+};
+
+typedef void (*TAGPRESENCE_CALLBACK)(TAGPRESENCE_EVENT * event, void * context);
+
+/*
+ Tracks one tag in the field, call update() from loop(). A present tag is
+ checked every presentInterval ms with Mifare::checkPresence (one
+ exchange), an empty field is polled every absentInterval ms with a
+ detect that gives up after a few activation retries.
+ 
+ The latency of an event is the time between the last check that saw the
+ old state and the event, the upper bound of how long the tag had been
+ there (or gone) when the application hears about it. checkTime is the
+ measured cost of the last check, to tune the intervals against the
+ reads the application has to do.
+ */
+class TagPresence{
+  public:
+    TagPresence(Mifare & mifare, TAGPRESENCE_CALLBACK callback, void * context);
+    
+    boolean begin(void);
+    void setIntervals(uint16_t presentInterval, uint16_t absentInterval);
+    void setPresentEvents(boolean enabled);
+    uint8_t update(void);
+    MIFARE_SESSION * getSession(void);
+    
+    uint16_t checkTime;             // ms taken by the last check or poll
+    
+  private:
+    Mifare * mifare;
+    TAGPRESENCE_CALLBACK callback;
+    void * context;
+    MIFARE_SESSION * session;
+    MIFARE_TARGET target;
+    uint16_t presentInterval;
+    uint16_t absentInterval;
+    boolean presentEvents;
+    unsigned long lastCheck;
+    unsigned long lastSeen;         // last check that saw the old state
+    
+    uint8_t raise(uint8_t type, unsigned long now);
+};
+
+#endif
@@ -0,0 +1,198 @@
+
+/**************************************************************************/
+/*! 
+    @file     benchmark_mifare.pde
+    @license 
+    
+    This file times the library's card operations against a tag held on
+    the reader, to compare the cost of the different ways of doing the
+    same thing. Results are printed in milliseconds.
+
+*/
+/**************************************************************************/
+
+
+//compiler complains if you don't include this even if you turn off the I2C.h 
+#include <Wire.h>
+
+//I2C:
+
+#include <PN532_I2C.h>
+
+#define IRQ   2
+#define RESET 3
+
+PN532 * board = new PN532_I2C(IRQ, RESET);
+
+//end I2C -->
+
+//SPI:
+
+//#include <PN532_SPI.h>
+//
+//#define SCK 13
+//#define MOSI 11
+//#define SS 10
+//#define MISO 12
+//
+//PN532 * board = new PN532_SPI(SCK, MISO, MOSI, SS);
+
+//end SPI -->
+
+#include <Mifare.h>
+Mifare mifare;
+//init keys for reading classic
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint32_t Mifare::cardType = 0; //will get overwritten if it finds a different card
+
+#include <NDEF.h>
+
+#define PAYLOAD_SIZE 64
+#define ROUNDS 5
+uint8_t payload[PAYLOAD_SIZE] = {};
+
+void setup(void) {
+  Serial.begin(115200);
+
+  board->begin();
+
+  if (! board->getFirmwareVersion()) {
+    Serial.println("err");
+    while (1); // halt
+  }
+  
+  if(!mifare.SAMConfig()){
+    Serial.println("er");
+  }
+}
+
+void printTime(const char * label, unsigned long start){
+  Serial.print(label); Serial.println(millis() - start, DEC);
+}
+
+/*
+ writePayload on a fresh session checks the classic MAD before writing,
+ later writes in the same session skip it
+ */
+void benchmarkWrite(uint16_t len){
+  unsigned long start;
+  
+  Serial.println("-- write, new session every time");
+  for (uint8_t i = 0; i < ROUNDS; i++){
+    MIFARE_SESSION * session = mifare.detect();
+    start = millis();
+    boolean success = mifare.writePayload(session, payload, len);
+    printTime(success ? "ms " : "fail ", start);
+  }
+  
+  Serial.println("-- write, one session");
+  MIFARE_SESSION * session = mifare.detect();
+  for (uint8_t i = 0; i < ROUNDS; i++){
+    start = millis();
+    boolean success = mifare.writePayload(session, payload, len);
+    printTime(success ? "ms " : "fail ", start);
+  }
+  mifare.release(session);
+}
+
+/*
+ readPayload streams the message, the PN532 reads the next block while the
+ host copies the current one
+ */
+void benchmarkRead(void){
+  uint8_t output[PAYLOAD_SIZE];
+  unsigned long start;
+  
+  Serial.println("-- read, one session");
+  MIFARE_SESSION * session = mifare.detect();
+  for (uint8_t i = 0; i < ROUNDS; i++){
+    start = millis();
+    boolean success = mifare.readPayload(session, output, PAYLOAD_SIZE);
+    printTime(success ? "ms " : "fail ", start);
+  }
+  mifare.release(session);
+}
+
+/*
+ 1 KB to an NTAG I2C plus whose I2C host turned pass-through on (RF to
+ I2C): 64 byte SRAM transfers against 4 byte EEPROM page writes
+ */
+void benchmarkSram(void){
+  static uint8_t bulk[1024];
+  static MIFARE_OP ops[64];
+  unsigned long start;
+  
+  Serial.println("-- 1 KB through SRAM, then 256 B as EEPROM pages");
+  MIFARE_SESSION * session = mifare.detect();
+  start = millis();
+  boolean success = mifare.writeSram(session, bulk, sizeof(bulk));
+  printTime(success ? "ms " : "fail ", start);
+  
+  for (uint8_t i = 0; i < 64; i++){
+    ops[i].operation = MIFARE_OP_WRITE;
+    ops[i].blockaddress = 4 + i;
+    ops[i].data = bulk + 4 * i;
+  }
+  start = millis();
+  success = mifare.execute(session, ops, 64);
+  printTime(success ? "ms " : "fail ", start);
+  mifare.release(session);
+}
+
+/*
+ applies each tuning profile with one WriteRegister frame, then times
+ detection of the tag with it. move the tag away to compare ranges
+ */
+MIFARE_REGISTER lowGain[] = {
+  {PN532_REG_CIU_RFCFG, 0x48}, {PN532_REG_CIU_GSNON, 0xF4}, {PN532_REG_CIU_CWGSP, 0x20},
+  {PN532_REG_CIU_MODGSP, 0x11}, {PN532_REG_CIU_RXTHRESHOLD, 0x84}};
+MIFARE_REGISTER highGain[] = {
+  {PN532_REG_CIU_RFCFG, 0x7A}, {PN532_REG_CIU_GSNON, 0xFF}, {PN532_REG_CIU_CWGSP, 0x3F},
+  {PN532_REG_CIU_MODGSP, 0x3F}, {PN532_REG_CIU_RXTHRESHOLD, 0x55}};
+
+void benchmarkProfile(const char * name, MIFARE_REGISTER * profile, uint8_t count){
+  unsigned long start;
+  uint8_t found = 0;
+  
+  Serial.print("-- profile "); Serial.println(name);
+  start = millis();
+  boolean success = mifare.writeRegisters(profile, count);
+  printTime(success ? "applied ms " : "fail ", start);
+  
+  start = millis();
+  for (uint8_t i = 0; i < ROUNDS; i++){
+    MIFARE_SESSION * session = mifare.detect(500);
+    if (session){
+      found++;
+      mifare.deselect(session);
+    }
+  }
+  Serial.print("detected "); Serial.print(found, DEC); Serial.print("/"); Serial.println(ROUNDS, DEC);
+  printTime("ms ", start);
+}
+
+void loop(void) {
+  Serial.println("place a tag on the reader");
+  MIFARE_SESSION * session = mifare.detect();
+  if (!session){
+    delay(1000);
+    return;
+  }
+  Serial.println(Mifare::cardType == MIFARE_ULTRALIGHT ? "Ultralight" : "Classic");
+  mifare.release(session);
+  
+  memset(payload, 0, PAYLOAD_SIZE);
+  memcpy(payload, "odopod.com", 10);
+  uint16_t len = NDEF().encode_URI(NDEF_URIPREFIX_HTTP, payload);
+  
+  benchmarkWrite(len);
+  benchmarkRead();
+  if (Mifare::cardType == MIFARE_ULTRALIGHT)
+    benchmarkSram();
+  benchmarkProfile("low gain", lowGain, 5);
+  benchmarkProfile("high gain", highGain, 5);
+  
+  delay(10000);
+}
@@ -0,0 +1,61 @@
+
+/**************************************************************************/
+/*! 
+    @file     dump_tag.pde
+    @author   Odopod, a Nurun Company
+    @license  BSD
+    
+    Prints the whole memory of a tag as hex, one block or page per line,
+    as it's read. The image doesn't have to fit in RAM: dump hands it over
+    chunk by chunk. Keep the output and restore it with Mifare::restore.
+
+*/
+/**************************************************************************/
+
+#include <Wire.h>
+#include <PN532_I2C.h>
+
+#define IRQ   2
+#define RESET 3
+
+PN532 * board = new PN532_I2C(IRQ, RESET);
+
+#include <Mifare.h>
+Mifare mifare;
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint32_t Mifare::cardType = 0;
+
+// classic blocks are 16 bytes a line, ultralight pages 4
+boolean printImage(uint8_t * data, uint8_t length, uint16_t offset, void * context) {
+  uint8_t line = (Mifare::cardType == MIFARE_ULTRALIGHT) ? 4 : 16;
+  
+  for (uint8_t i = 0; i < length; i++) {
+    if (data[i] < 0x10) Serial.print("0");
+    Serial.print(data[i], HEX);
+    if (offset + i < MIFARE_IMAGE_HEADER ? offset + i == MIFARE_IMAGE_HEADER - 1 : (offset + i - MIFARE_IMAGE_HEADER) % line == line - 1)
+      Serial.println("");
+  }
+  return true;
+}
+
+void setup(void) {
+  Serial.begin(115200);
+  board->begin();
+  mifare.SAMConfig();
+}
+
+void loop(void) {
+  MIFARE_SESSION * session = mifare.detect();
+  
+  if (session) {
+    unsigned long start = millis();
+    boolean dumped = mifare.dump(session, printImage, 0);
+    
+    Serial.print(dumped ? "dumped in " : "failed after ");
+    Serial.print(millis() - start, DEC); Serial.println(" ms");
+    mifare.release(session);
+  }
+  delay(3000);
+}
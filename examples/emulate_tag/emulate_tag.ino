@@ -0,0 +1,61 @@
+
+/**************************************************************************/
+/*! 
+    @file     emulate_tag.pde
+    @author   Odopod, a Nurun Company
+    @license  BSD
+    
+    Presents a URI to phones as an NFC Forum type 4 tag, no physical tag
+    needed. The message is encoded once in setup and served from RAM.
+
+    Emulation needs SPI, TgInitAsTarget is longer than the AVR Wire buffer.
+
+*/
+/**************************************************************************/
+
+//compiler complains if you don't include this even if you turn off the I2C.h 
+#include <Wire.h>
+
+//SPI:
+
+#include <PN532_SPI.h>
+
+#define SCK 13
+#define MOSI 11
+#define SS 10
+#define MISO 12
+
+PN532 * board = new PN532_SPI(SCK, MISO, MOSI, SS);
+
+//end SPI -->
+
+#include <Mifare.h>
+#include <NDEF.h>
+#include <TagEmulator.h>
+Mifare mifare;
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint32_t Mifare::cardType = 0;
+
+TagEmulator emulator(board);
+
+uint8_t image[64];
+
+void setup(void) {
+  Serial.begin(115200);
+  board->begin();
+  mifare.SAMConfig();
+  emulator.begin();
+  
+  memcpy(image, "odopod.com", 11);
+  uint16_t len = NDEF().encode_URI(NDEF_URIPREFIX_HTTP, image);
+  emulator.setMessage(image, len);
+}
+
+void loop(void) {
+  if (emulator.emulate(1000)) {
+    Serial.print("read by a phone, APDUs: ");
+    Serial.println(emulator.apduCount, DEC);
+  }
+}
@@ -0,0 +1,135 @@
+/**************************************************************************/
+/*! 
+    @file     large_payload.pde
+    @license 
+    
+    This file writes a TEXT message of TEXT_SIZE characters to a tag large
+    enough to hold it (NTAG216, Mifare Classic 4K), streams it back through
+    NDEF_Stream and checks every character, so a long record spread over
+    many blocks and sectors round trips. Write and read times are printed
+    in milliseconds.
+
+*/
+/**************************************************************************/
+
+
+//compiler complains if you don't include this even if you turn off the I2C.h 
+#include <Wire.h>
+
+//I2C:
+
+#include <PN532_I2C.h>
+
+#define IRQ   2
+#define RESET 3
+
+PN532 * board = new PN532_I2C(IRQ, RESET);
+
+//end I2C -->
+
+//SPI:
+
+//#include <PN532_SPI.h>
+//
+//#define SCK 13
+//#define MOSI 11
+//#define SS 10
+//#define MISO 12
+//
+//PN532 * board = new PN532_SPI(SCK, MISO, MOSI, SS);
+
+//end SPI -->
+
+#include <Mifare.h>
+Mifare mifare;
+//init keys for reading classic
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint32_t Mifare::cardType = 0; //will get overwritten if it finds a different card
+
+#include <NDEF.h>
+
+#define TEXT_SIZE 800
+// the TLV, the long record header, status byte, language and terminator add 15 bytes
+#define PAYLOAD_SIZE (TEXT_SIZE + 15)
+uint8_t payload[PAYLOAD_SIZE] = {};
+
+// what the stream found, checked against the text written
+struct CHECK{
+    uint32_t length;        // payload length of the record
+    uint16_t checked;       // characters compared
+    uint16_t errors;        // characters that differ
+};
+
+void setup(void) {
+  Serial.begin(115200);
+
+  board->begin();
+
+  if (! board->getFirmwareVersion()) {
+    Serial.println("err");
+    while (1); // halt
+  }
+  
+  if(!mifare.SAMConfig()){
+    Serial.println("er");
+  }
+}
+
+char textAt(uint16_t i){
+  return 'a' + (i % 26);
+}
+
+/*
+ the text record payload is a status byte and the 2 byte language, then
+ the text
+ */
+void checkRecord(NDEF_RECORD * record, uint8_t * data, uint8_t length, uint32_t offset, void * context){
+  CHECK * check = (CHECK *) context;
+  check->length = record->payloadLength;
+  
+  for(uint8_t i = 0; i < length; i++){
+    if(offset + i < 3) continue;
+    
+    if(data[i] != textAt(offset + i - 3)) check->errors++;
+    check->checked++;
+  }
+}
+
+void loop(void) {
+  MIFARE_SESSION * session = mifare.detect();
+  if(session){
+    boolean classic = Mifare::cardType == MIFARE_CLASSIC || Mifare::cardType == MIFARE_CLASSIC_4K;
+    Serial.println(classic ? "Classic" : "Ultralight");
+    
+    for(uint16_t i = 0; i < TEXT_SIZE; i++){
+      payload[i] = textAt(i);
+    }
+    payload[TEXT_SIZE] = 0;
+    uint16_t len = NDEF().encode_TEXT((uint8_t *)"en", payload);
+    
+    unsigned long start = millis();
+    boolean success = mifare.writePayload(session, payload, len);
+    Serial.print("write "); Serial.print(len, DEC); Serial.print(" bytes: ");
+    Serial.println(millis() - start, DEC);
+    
+    if(success){
+      CHECK check = {0, 0, 0};
+      NDEF_Stream stream(checkRecord, &check);
+      
+      start = millis();
+      success = mifare.streamPayload(session, NDEF_Stream::consume, &stream) && stream.complete();
+      Serial.print("read: "); Serial.println(millis() - start, DEC);
+      
+      success = success && check.length == TEXT_SIZE + 3 && check.checked == TEXT_SIZE && !check.errors;
+      Serial.print("checked "); Serial.print(check.checked, DEC);
+      Serial.print(", errors "); Serial.println(check.errors, DEC);
+    }
+    
+    Serial.println(success ? "success" : "fail");
+    
+    mifare.release(session);
+  }
+  delay(5000);
+}
@@ -0,0 +1,107 @@
+
+/**************************************************************************/
+/*! 
+    @file     p2p_transfer.pde
+    @author   Odopod, a Nurun Company
+    @license  BSD
+    
+    Moves a block of data both ways between two boards over NFC-DEP and
+    prints the throughput. Flash one board with INITIATOR set to 1 and the
+    other with 0, then hold the antennas together. Each side checks the
+    data it received against the block it sent.
+
+    The target needs SPI, TgInitAsTarget is longer than the AVR Wire
+    buffer. The initiator runs over I2C too, in smaller chunks.
+
+*/
+/**************************************************************************/
+
+//compiler complains if you don't include this even if you turn off the I2C.h 
+#include <Wire.h>
+
+//SPI:
+
+#include <PN532_SPI.h>
+
+#define SCK 13
+#define MOSI 11
+#define SS 10
+#define MISO 12
+
+PN532 * board = new PN532_SPI(SCK, MISO, MOSI, SS);
+
+//end SPI -->
+
+//I2C, initiator only:
+
+//#include <PN532_I2C.h>
+//
+//#define IRQ   2
+//#define RESET 3
+//
+//PN532 * board = new PN532_I2C(IRQ, RESET);
+
+//end I2C -->
+
+#include <Mifare.h>
+#include <PeerToPeer.h>
+Mifare mifare;
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint32_t Mifare::cardType = 0;
+
+PeerToPeer p2p(board);
+
+#define INITIATOR 1
+#define BLOB_SIZE 2048
+
+uint8_t blob[BLOB_SIZE];
+uint32_t checksum;
+uint32_t expected;      // checksum of blob, what the other side sends
+
+boolean onChunk(uint8_t * data, uint8_t length, uint32_t offset, void * context){
+  for (uint8_t i = 0; i < length; i++)
+    checksum += data[i];
+  return true;
+}
+
+void setup(void) {
+  Serial.begin(115200);
+  board->begin();
+  mifare.SAMConfig();
+  
+  expected = 0;
+  for (uint16_t i = 0; i < BLOB_SIZE; i++){
+    blob[i] = i;
+    expected += blob[i];
+  }
+}
+
+void loop(void) {
+  uint32_t received = 0;
+  boolean linked = INITIATOR ? p2p.initiate(P2P_424, 1000) : p2p.listen(1000);
+  if (!linked)
+    return;
+  
+  unsigned long start = millis();
+  checksum = 0;
+  
+  // the initiator sends first, both sides in the same order
+  boolean ok;
+  if (INITIATOR)
+    ok = p2p.send(blob, BLOB_SIZE) && p2p.receive(onChunk, 0, &received);
+  else
+    ok = p2p.receive(onChunk, 0, &received) && p2p.send(blob, BLOB_SIZE);
+  
+  unsigned long elapsed = millis() - start;
+  p2p.release();
+  
+  ok = ok && received == BLOB_SIZE && checksum == expected;
+  
+  Serial.print(ok ? "ok " : "fail "); Serial.print(BLOB_SIZE + received, DEC);
+  Serial.print(" bytes in chunks of "); Serial.print(p2p.getChunkSize(), DEC);
+  Serial.print(", "); Serial.print(elapsed, DEC); Serial.print(" ms, ");
+  Serial.print((BLOB_SIZE + received) / (elapsed ? elapsed : 1), DEC); Serial.println(" kB/s");
+  delay(2000);
+}
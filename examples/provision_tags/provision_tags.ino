@@ -0,0 +1,62 @@
+
+/**************************************************************************/
+/*! 
+    @file     provision_tags.pde
+    @author   Odopod, a Nurun Company
+    @license  BSD
+    
+    Writes the same URI to every tag put on the reader, for an encoding
+    line. The message is encoded once in setup, each tag is written and
+    read back, and the throughput is printed in tags per minute.
+
+*/
+/**************************************************************************/
+
+#include <Wire.h>
+#include <PN532_I2C.h>
+
+#define IRQ   2
+#define RESET 3
+
+PN532 * board = new PN532_I2C(IRQ, RESET);
+
+#include <Mifare.h>
+#include <NDEF.h>
+Mifare mifare;
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint32_t Mifare::cardType = 0;
+
+// one op per ultralight page of the message, enough for 160 bytes
+#define OPS 40
+
+uint8_t payload[160];
+MIFARE_OP ops[OPS];
+MIFARE_PROVISION provision;
+
+void setup(void) {
+  Serial.begin(115200);
+  board->begin();
+  mifare.SAMConfig();
+  
+  memcpy(payload, "odopod.com", 11);
+  uint16_t len = NDEF().encode_URI(NDEF_URIPREFIX_HTTP, payload);
+  
+  provision.ops = ops;
+  provision.size = OPS;
+  provision.verify = true;
+  mifare.prepareProvisioning(&provision, payload, len);
+}
+
+void loop(void) {
+  uint16_t failures = provision.failures;
+  
+  if (mifare.provision(&provision, 1000)) {
+    Serial.print("ok, tags: "); Serial.print(provision.tags, DEC);
+    Serial.print(", per minute: "); Serial.print(provision.rate, DEC);
+    Serial.print(", ms per tag: "); Serial.println(provision.time / provision.tags, DEC);
+  } else if (provision.failures != failures) {
+    Serial.println("failed, put the tag back");
+  }
+}
@@ -0,0 +1,143 @@
+/**************************************************************************/
+/*! 
+    @file     read_felica.pde
+    @license 
+    
+    This file reads the NDEF message of a FeliCa (NFC Forum type 3) tag at
+    424 kbps. It prints the IDm and the attribute block, then streams the
+    message, printing the length of every Read Without Encryption, so the
+    number of blocks read per exchange shows, and decodes it.
+
+    A block takes a 39 byte response, more than the AVR Wire buffer holds,
+    so FeliCa reads need SPI.
+
+*/
+/**************************************************************************/
+
+
+//compiler complains if you don't include this even if you turn off the I2C.h 
+#include <Wire.h>
+
+//SPI:
+
+#include <PN532_SPI.h>
+
+#define SCK 13
+#define MOSI 11
+#define SS 10
+#define MISO 12
+
+PN532 * board = new PN532_SPI(SCK, MISO, MOSI, SS);
+
+//end SPI -->
+
+//I2C, only with a Wire buffer that holds a FeliCa frame (PN532::responselimit):
+
+//#include <PN532_I2C.h>
+//
+//#define IRQ   2
+//#define RESET 3
+//
+//PN532 * board = new PN532_I2C(IRQ, RESET);
+
+//end I2C -->
+
+#include <Mifare.h>
+Mifare mifare;
+//keys are only used by classic tags
+uint8_t Mifare::useKey = KEY_A;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint32_t Mifare::cardType = 0; //will get overwritten if it finds a different card
+
+#include <NDEF.h>
+
+#define PAYLOAD_SIZE 224
+uint8_t payload[PAYLOAD_SIZE] = {};
+
+void setup(void) {
+  Serial.begin(115200);
+
+  board->begin();
+
+  if (! board->getFirmwareVersion()) {
+    Serial.println("err");
+    while (1); // halt
+  }
+  
+  if(!mifare.SAMConfig()){
+    Serial.println("er");
+  }
+}
+
+void printHex(uint8_t * data, uint8_t length){
+  for(uint8_t i = 0; i < length; i++){
+    if(data[i] < 0x10) Serial.print("0");
+    Serial.print(data[i], HEX);
+  }
+  Serial.println("");
+}
+
+/*
+ one call per Read Without Encryption, several blocks at a time
+ */
+boolean printRead(uint8_t * data, uint8_t length, uint16_t offset, uint16_t total, void * context){
+  uint8_t * reads = (uint8_t *) context;
+  (*reads)++;
+  
+  Serial.print("read "); Serial.print(length, DEC);
+  Serial.print(" bytes at "); Serial.print(offset, DEC);
+  Serial.print(" of "); Serial.println(total, DEC);
+  return true;
+}
+
+void loop(void) {
+  MIFARE_SESSION * session = mifare.detectFeliCa(MIFARE_FELICA_424);
+  if(session){
+    Serial.print("IDm: ");
+    printHex(session->target.uid, session->target.uidLength);
+    
+    uint8_t attributes[16];
+    if(mifare.readFeliCaBlocks(session, FELICA_SERVICE_NDEF_READ, 0, 1, attributes)){
+      Serial.print("attributes: ");
+      printHex(attributes, 16);
+    }
+    
+    uint8_t reads = 0;
+    unsigned long start = millis();
+    boolean success = mifare.streamPayload(session, printRead, &reads);
+    Serial.print(reads, DEC); Serial.print(" reads in ");
+    Serial.print(millis() - start, DEC); Serial.println(" ms");
+    
+    memset(payload, 0, PAYLOAD_SIZE);
+    if(success && mifare.readPayload(session, payload, PAYLOAD_SIZE)){
+      FOUND_MESSAGE m = NDEF().decode_message(payload);
+      
+      switch(m.type){
+       case NDEF_TYPE_URI:
+         Serial.print("URI: ");
+         Serial.println((int)m.format);
+         Serial.println((char*) m.payload); 
+        break;
+       case NDEF_TYPE_TEXT:
+         Serial.print("TEXT: "); 
+         Serial.println(m.format);
+         Serial.println((char*)m.payload);
+        break;
+       case NDEF_TYPE_MIME:
+         Serial.print("MIME: "); 
+         Serial.println(m.format);
+         Serial.println((char*)m.payload);
+        break;
+       default:
+         Serial.println("unsupported");
+        break; 
+      }
+    }else{
+      Serial.println("fail");
+    }
+    
+    mifare.release(session);
+  }
+  delay(5000);
+}
@@ -84,15 +84,15 @@ void setup(void) {
 
 
 void loop(void) {
- uint8_t * uid = mifare.readTarget();
- if(uid){
+ MIFARE_SESSION * session = mifare.detect();
+ if(session){
    Serial.println(Mifare::cardType == MIFARE_CLASSIC ?"Classic" : "Ultralight");
     
     memset(payload, 0, PAYLOAD_SIZE);
     
       //read 
     
-      mifare.readPayload(payload, PAYLOAD_SIZE);
+      mifare.readPayload(session, payload, PAYLOAD_SIZE);
   
       FOUND_MESSAGE m = NDEF().decode_message(payload);
       
@@ -116,6 +116,8 @@ void loop(void) {
          Serial.println("unsupported");
         break; 
       }  
+      
+      mifare.release(session);
  }
  delay(5000);
 }
@@ -0,0 +1,58 @@
+/**************************************************************************/
+/*! 
+    @file     arduino.cpp
+    @license  BSD
+    
+    Host side Arduino core for the tests, see arduino/Arduino.h
+
+*/
+/**************************************************************************/
+
+#include "Arduino.h"
+#include "PN532_Com.h"
+#include <atomic>
+
+HostSerial Serial;
+
+// advanced by delay() only, shared by the threads of linked boards
+static std::atomic<unsigned long> clock_ms(0);
+
+void delay(unsigned long ms){
+    clock_ms += ms;
+}
+
+void delayMicroseconds(unsigned int){
+}
+
+unsigned long millis(void){
+    return clock_ms;
+}
+
+unsigned long micros(void){
+    return clock_ms * 1000;
+}
+
+void pinMode(uint8_t, uint8_t){
+}
+
+void digitalWrite(uint8_t, uint8_t){
+}
+
+int digitalRead(uint8_t){
+    return 0;
+}
+
+/*
+ PN532_Com.h declares the transport without bodies, PN532_I2C and
+ PN532_SPI define them. the emulated boards override every one of them,
+ these only give the base class its vtable
+ */
+void PN532::begin(void){}
+uint32_t PN532::getFirmwareVersion(void){ return 0; }
+boolean PN532::readack(void){ return false; }
+boolean PN532::sendCommandCheckAck(uint8_t *, uint8_t, uint16_t){ return false; }
+boolean PN532::sendCommandAck(uint8_t *, uint8_t, uint16_t){ return false; }
+boolean PN532::waitready(uint16_t){ return false; }
+uint8_t PN532::readstatus(void){ return PN532_BUSY; }
+void PN532::readdata(uint8_t *, uint8_t){}
+void PN532::sendcommand(uint8_t *, uint8_t){}
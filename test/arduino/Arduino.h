@@ -0,0 +1,50 @@
+/**************************************************************************/
+/*! 
+    @file     Arduino.h
+    @license  BSD
+    
+    The parts of the Arduino core the library uses, for the host tests.
+    Time is simulated: delay() moves millis() on without sleeping.
+
+*/
+/**************************************************************************/
+
+#ifndef __TEST_ARDUINO_INCLUDED__
+#define __TEST_ARDUINO_INCLUDED__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+#define DEC     10
+#define HEX     16
+
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis(void);
+unsigned long micros(void);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+// library debug output goes nowhere
+struct HostSerial{
+    void begin(long){}
+    template<class T> void print(T){}
+    template<class T> void print(T, int){}
+    template<class T> void println(T){}
+    template<class T> void println(T, int){}
+    void println(void){}
+    void write(uint8_t){}
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,532 @@
+/**************************************************************************/
+/*!
+    @file     emulator.cpp
+    @license  BSD
+
+    A PN532 and the tags in its field, emulated on the host, see emulator.h
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+
+#define PN532_PN532TOHOST   (0xD5)
+
+// trailer of a classic sector, 4 blocks each up to sector 31 then 16
+uint16_t classicTrailer(uint8_t sector){
+    return (sector < 32) ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+}
+
+uint8_t classicSectorOf(uint8_t block){
+    return (block < 128) ? block / 4 : 32 + (block - 128) / 16;
+}
+
+static bool isTrailer(uint8_t block){
+    return block == classicTrailer(classicSectorOf(block));
+}
+
+// key B of a trailer can be read unless C1 is set or C2 and C3 both are
+static bool keyBReadable(const uint8_t * trailer){
+    uint8_t c1 = (trailer[7] >> 7) & 1;
+    uint8_t c2 = (trailer[8] >> 3) & 1;
+    uint8_t c3 = (trailer[8] >> 7) & 1;
+    return c1 == 0 && !(c2 && c3);
+}
+
+static EmulatedTag * newTag(uint32_t type, uint8_t uidLength, uint8_t uidByte){
+    EmulatedTag * tag = new EmulatedTag();
+    tag->type = type;
+    tag->uidLength = uidLength;
+    for (uint8_t i = 0; i < uidLength; i++)
+        tag->uid[i] = uidByte + i;
+    tag->systemCode = 0;
+    tag->maxBlocks = 0;
+    tag->present = true;
+    tag->halted = false;
+    tag->authSector = -1;
+    return tag;
+}
+
+/*
+ a blank classic card, every trailer holding keyA and keyB with the
+ transport access bits FF 07 80. type is MIFARE_CLASSIC or MIFARE_CLASSIC_4K
+ */
+EmulatedTag * classicTag(uint32_t type, uint8_t uidByte, const uint8_t * keyA, const uint8_t * keyB){
+    EmulatedTag * tag = newTag(type, 4, uidByte);
+    uint16_t blocks = (type == MIFARE_CLASSIC_4K) ? 256 : 64;
+    tag->memory.assign(blocks * 16, 0);
+    memcpy(&tag->memory[0], tag->uid, 4);
+    for (uint16_t b = 0; b < blocks; b++) {
+        if (! isTrailer(b))
+            continue;
+        uint8_t * trailer = &tag->memory[b * 16];
+        memcpy(trailer, keyA, 6);
+        trailer[6] = 0xFF;
+        trailer[7] = 0x07;
+        trailer[8] = 0x80;
+        trailer[9] = 0x69;
+        memcpy(trailer + 10, keyB, 6);
+    }
+    return tag;
+}
+
+// an ultralight of the given number of pages, formatted for NDEF and empty
+EmulatedTag * ultralightTag(uint8_t pages, uint8_t uidByte){
+    EmulatedTag * tag = newTag(MIFARE_ULTRALIGHT, 7, uidByte);
+    tag->memory.assign(pages * 4, 0);
+    memcpy(&tag->memory[0], tag->uid, 3);
+    memcpy(&tag->memory[4], tag->uid + 3, 4);
+    tag->memory[12] = 0xE1;
+    tag->memory[13] = 0x10;
+    tag->memory[14] = (pages - 4) * 4 / 8;
+    return tag;
+}
+
+// an NTAG213 (45 pages), NTAG215 (135) or NTAG216 (231), with GET_VERSION and FAST_READ
+EmulatedTag * ntagTag(uint8_t pages, uint8_t uidByte){
+    static const uint8_t version[8] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x0F, 0x03};
+    EmulatedTag * tag = ultralightTag(pages, uidByte);
+    tag->version.assign(version, version + 8);
+    if (pages == 45) {
+        tag->memory[14] = 0x12;
+    } else if (pages == 135) {
+        tag->memory[14] = 0x3E;
+        tag->version[6] = 0x11;
+    } else {
+        tag->memory[14] = 0x6D;
+        tag->version[6] = 0x13;
+    }
+    return tag;
+}
+
+/*
+ a type 3 tag with the NDEF system code, its attribute block and blocks
+ data blocks holding message
+ */
+EmulatedTag * felicaTag(const uint8_t * message, uint16_t length, uint8_t maxBlocks, uint16_t blocks){
+    EmulatedTag * tag = newTag(MIFARE_FELICA, 8, 0x01);
+    tag->systemCode = FELICA_SYSTEM_NDEF;
+    tag->maxBlocks = maxBlocks;
+    tag->memory.assign((blocks + 1) * 16, 0);
+
+    uint8_t * attribute = &tag->memory[0];
+    attribute[0] = 0x10;
+    attribute[1] = maxBlocks;
+    attribute[2] = 1;
+    attribute[3] = blocks >> 8;
+    attribute[4] = blocks;
+    attribute[12] = length >> 8;
+    attribute[13] = length;
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < 14; i++)
+        sum += attribute[i];
+    attribute[14] = sum >> 8;
+    attribute[15] = sum;
+
+    memcpy(&tag->memory[16], message, length);
+    return tag;
+}
+
+
+EmulatedBoard::EmulatedBoard(){
+    commandLimit = PN532_FRAMESIZE - 1;
+    responseLimit = PN532_FRAMESIZE;
+    active = -1;
+    clearCounters();
+}
+
+// PN532_I2C on AVR, limited by the 32 byte Wire buffer
+void EmulatedBoard::limitToAvrI2C(void){
+    commandLimit = 24;
+    responseLimit = 30;
+}
+
+void EmulatedBoard::clearCounters(void){
+    exchanges = 0;
+    authentications = 0;
+    reads = 0;
+    writes = 0;
+    registerFrames = 0;
+    overruns = 0;
+}
+
+boolean EmulatedBoard::sendCommandCheckAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout){
+    handle(cmd, cmdlen);
+    return true;
+}
+
+boolean EmulatedBoard::sendCommandAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout){
+    handle(cmd, cmdlen);
+    return true;
+}
+
+void EmulatedBoard::sendcommand(uint8_t * cmd, uint8_t cmdlen){
+    handle(cmd, cmdlen);
+}
+
+void EmulatedBoard::readdata(uint8_t * buff, uint8_t n){
+    if (n > responseLimit)
+        overruns++;
+    for (uint8_t i = 0; i < n; i++)
+        buff[i] = (i < response.size()) ? response[i] : 0;
+}
+
+// a response frame: 00 00 FF LEN LCS D5 code data DCS 00
+void responseFrame(uint8_t code, const std::vector<uint8_t> & data, std::vector<uint8_t> & frame){
+    uint8_t length = data.size() + 2;
+    uint8_t sum = PN532_PN532TOHOST + code;
+
+    frame.clear();
+    frame.push_back(PN532_PREAMBLE);
+    frame.push_back(PN532_STARTCODE1);
+    frame.push_back(PN532_STARTCODE2);
+    frame.push_back(length);
+    frame.push_back(~length + 1);
+    frame.push_back(PN532_PN532TOHOST);
+    frame.push_back(code);
+    for (size_t i = 0; i < data.size(); i++) {
+        frame.push_back(data[i]);
+        sum += data[i];
+    }
+    frame.push_back(~sum + 1);
+    frame.push_back(PN532_POSTAMBLE);
+}
+
+void EmulatedBoard::reply(uint8_t code, const std::vector<uint8_t> & data){
+    responseFrame(code, data, response);
+}
+
+EmulatedTag * EmulatedBoard::target(uint8_t tg){
+    if (tg < 1 || tg > listed.size())
+        return 0;
+    EmulatedTag * tag = tags[listed[tg - 1]];
+    return tag->present ? tag : 0;
+}
+
+void EmulatedBoard::handle(uint8_t * cmd, uint8_t length){
+    if (length > commandLimit)
+        overruns++;
+    exchanges++;
+
+    std::vector<uint8_t> data;
+    EmulatedTag * tag;
+
+    switch (cmd[0]) {
+    case PN532_COMMAND_READREGISTER:
+        registerFrames++;
+        for (uint8_t i = 1; i + 1 < length; i += 2)
+            data.push_back(registers[(cmd[i] << 8) | cmd[i + 1]]);
+        reply(cmd[0] + 1, data);
+        break;
+
+    case PN532_COMMAND_WRITEREGISTER:
+        registerFrames++;
+        for (uint8_t i = 1; i + 2 < length; i += 3)
+            registers[(cmd[i] << 8) | cmd[i + 1]] = cmd[i + 2];
+        reply(cmd[0] + 1, data);
+        break;
+
+    case PN532_COMMAND_INLISTPASSIVETARGET:
+        listTargets(cmd);
+        break;
+
+    case PN532_COMMAND_INDATAEXCHANGE:
+        tag = target(cmd[1]);
+        active = tag ? listed[cmd[1] - 1] : -1;
+        if (! tag || tag->halted) {
+            data.push_back(0x01);
+            reply(cmd[0] + 1, data);
+        } else {
+            exchange(tag, cmd + 2, length - 2);
+        }
+        break;
+
+    case PN532_COMMAND_INCOMMUNICATETHRU:
+        // raw frames go to the last target selected
+        tag = (active >= 0 && tags[active]->present) ? tags[active] : 0;
+        if (tag && ! tag->halted && cmd[1] == MIFARE_CMD_GET_VERSION && ! tag->version.empty()) {
+            data.push_back(0x00);
+            data.insert(data.end(), tag->version.begin(), tag->version.end());
+        } else {
+            if (tag)
+                tag->halted = true;
+            data.push_back(0x01);
+        }
+        reply(cmd[0] + 1, data);
+        break;
+
+    case PN532_COMMAND_INSELECT:
+    case PN532_COMMAND_INDESELECT:
+    case PN532_COMMAND_INRELEASE:
+        if (cmd[0] == PN532_COMMAND_INRELEASE && cmd[1] == 0) {
+            for (size_t i = 0; i < listed.size(); i++) {
+                tags[listed[i]]->halted = true;
+                tags[listed[i]]->authSector = -1;
+            }
+            data.push_back(0x00);
+        } else if ((tag = target(cmd[1])) == 0) {
+            data.push_back(0x27);
+        } else {
+            tag->authSector = -1;
+            tag->halted = (cmd[0] != PN532_COMMAND_INSELECT);
+            if (cmd[0] == PN532_COMMAND_INSELECT)
+                active = listed[cmd[1] - 1];
+            data.push_back(0x00);
+        }
+        reply(cmd[0] + 1, data);
+        break;
+
+    case PN532_COMMAND_RFCONFIGURATION:
+        // switching the field off resets every tag
+        if (cmd[1] == 0x01 && (cmd[2] & 0x01) == 0) {
+            for (size_t i = 0; i < tags.size(); i++) {
+                tags[i]->halted = false;
+                tags[i]->authSector = -1;
+            }
+        }
+        reply(cmd[0] + 1, data);
+        break;
+
+    case PN532_COMMAND_SAMCONFIGURATION:
+        reply(cmd[0] + 1, data);
+        break;
+
+    default:
+        data.push_back(0x00);
+        reply(cmd[0] + 1, data);
+        break;
+    }
+}
+
+/*
+ InListPassiveTarget at 106 kbps type A (BrTy 0) or FeliCa (1 and 2, with
+ the polling request after it). halted tags and tags out of the field
+ don't answer
+ */
+void EmulatedBoard::listTargets(uint8_t * cmd){
+    bool felicaPoll = (cmd[2] == MIFARE_FELICA_212 || cmd[2] == MIFARE_FELICA_424);
+    uint16_t systemCode = (cmd[4] << 8) | cmd[5];
+    std::vector<uint8_t> data(1, 0);
+
+    listed.clear();
+    for (size_t i = 0; i < tags.size() && data[0] < cmd[1]; i++) {
+        EmulatedTag * tag = tags[i];
+        if (! tag->present || tag->halted || (tag->type == MIFARE_FELICA) != felicaPoll)
+            continue;
+        if (felicaPoll && systemCode != 0xFFFF && systemCode != tag->systemCode)
+            continue;
+
+        data[0]++;
+        data.push_back(data[0]);
+        if (felicaPoll) {
+            // POL_RES: length, response code, IDm, PMm, system code
+            data.push_back(0x14);
+            data.push_back(0x01);
+            data.insert(data.end(), tag->uid, tag->uid + 8);
+            for (uint8_t j = 0; j < 8; j++)
+                data.push_back(0x10 + j);
+            data.push_back(tag->systemCode >> 8);
+            data.push_back(tag->systemCode);
+        } else {
+            // SENS_RES, SEL_RES, NFCID
+            data.push_back(tag->type >> 16);
+            data.push_back(tag->type >> 8);
+            data.push_back(tag->type);
+            data.push_back(tag->uidLength);
+            data.insert(data.end(), tag->uid, tag->uid + tag->uidLength);
+        }
+        tag->authSector = -1;
+        listed.push_back(i);
+    }
+    active = listed.empty() ? -1 : listed[0];
+    reply(PN532_COMMAND_INLISTPASSIVETARGET + 1, data);
+}
+
+void EmulatedBoard::exchange(EmulatedTag * tag, uint8_t * frame, uint8_t length){
+    if (tag->type == MIFARE_FELICA)
+        felica(tag, frame, length);
+    else if (tag->type == MIFARE_ULTRALIGHT)
+        ultralight(tag, frame, length);
+    else
+        classic(tag, frame, length);
+}
+
+/*
+ a tag that NAKs or doesn't answer halts, and the PN532 reports a
+ timeout (0x01) or a MIFARE error (0x14)
+ */
+void EmulatedBoard::classic(EmulatedTag * tag, uint8_t * frame, uint8_t length){
+    std::vector<uint8_t> data(1, 0);
+    uint8_t block = frame[1];
+    uint8_t sector = classicSectorOf(block);
+
+    if (block * 16 >= tag->memory.size()) {
+        tag->halted = true;
+        data[0] = 0x14;
+        reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+        return;
+    }
+
+    if (frame[0] == MIFARE_CMD_AUTH_A || frame[0] == MIFARE_CMD_AUTH_B) {
+        authentications++;
+        const uint8_t * key = &tag->memory[classicTrailer(sector) * 16 + (frame[0] == MIFARE_CMD_AUTH_A ? 0 : 10)];
+        if (length >= 12 && memcmp(key, frame + 2, 6) == 0) {
+            tag->authSector = sector;
+        } else {
+            tag->authSector = -1;
+            tag->halted = true;
+            data[0] = 0x14;
+        }
+        reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+        return;
+    }
+
+    if (tag->authSector != sector) {
+        tag->halted = true;
+        data[0] = 0x14;
+        reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+        return;
+    }
+
+    uint8_t * memory = &tag->memory[block * 16];
+    switch (frame[0]) {
+    case MIFARE_CMD_READ:
+        reads++;
+        data.insert(data.end(), memory, memory + 16);
+        if (isTrailer(block)) {
+            // key A never reads back, key B only when the access bits allow it
+            memset(&data[1], 0, 6);
+            if (! keyBReadable(memory))
+                memset(&data[11], 0, 6);
+        }
+        break;
+
+    case MIFARE_CMD_WRITE_CLASSIC:
+        writes++;
+        memcpy(memory, frame + 2, 16);
+        break;
+
+    default:
+        tag->halted = true;
+        data[0] = 0x14;
+        break;
+    }
+    reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+}
+
+/*
+ READ wraps around the end of memory. WRITE to the lock bytes of page 2
+ and to the OTP page 3 ORs the bits in. FAST_READ only on tags that have
+ GET_VERSION
+ */
+void EmulatedBoard::ultralight(EmulatedTag * tag, uint8_t * frame, uint8_t length){
+    std::vector<uint8_t> data(1, 0);
+    uint16_t pages = tag->memory.size() / 4;
+    uint8_t page = frame[1];
+
+    switch (frame[0]) {
+    case MIFARE_CMD_READ:
+        reads++;
+        if (page >= pages) {
+            data[0] = 0x14;
+            tag->halted = true;
+            break;
+        }
+        for (uint8_t i = 0; i < 16; i++)
+            data.push_back(tag->memory[(page * 4 + i) % tag->memory.size()]);
+        break;
+
+    case NTAG_CMD_FAST_READ:
+        reads++;
+        if (tag->version.empty() || frame[2] < page || frame[2] >= pages) {
+            data[0] = 0x01;
+            tag->halted = true;
+            break;
+        }
+        data.insert(data.end(), &tag->memory[page * 4], &tag->memory[page * 4] + (frame[2] - page + 1) * 4);
+        break;
+
+    case MIFARE_CMD_WRITE_ULTRALIGHT:
+        writes++;
+        if (page < 2 || page >= pages || length < 6) {
+            data[0] = 0x14;
+            tag->halted = true;
+        } else if (page == 2) {
+            tag->memory[10] |= frame[4];
+            tag->memory[11] |= frame[5];
+        } else if (page == 3) {
+            for (uint8_t i = 0; i < 4; i++)
+                tag->memory[12 + i] |= frame[2 + i];
+        } else {
+            memcpy(&tag->memory[page * 4], frame + 2, 4);
+        }
+        break;
+
+    default:
+        // AUTH_A and anything else gets no answer
+        data[0] = 0x01;
+        tag->halted = true;
+        break;
+    }
+    reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+}
+
+/*
+ Request Response and Read Without Encryption of the NDEF service (0x000B).
+ the frame is LEN, command code, IDm, then the parameters
+ */
+void EmulatedBoard::felica(EmulatedTag * tag, uint8_t * frame, uint8_t length){
+    std::vector<uint8_t> data;
+
+    if (frame[0] != length || length < 10 || memcmp(frame + 2, tag->uid, 8) != 0) {
+        data.push_back(0x01);
+        reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+        return;
+    }
+
+    data.push_back(0x00);
+    data.push_back(0);
+    data.push_back(frame[1] + 1);
+    data.insert(data.end(), tag->uid, tag->uid + 8);
+
+    if (frame[1] == FELICA_CMD_REQUEST_RESPONSE) {
+        data.push_back(0x00);
+    } else if (frame[1] == FELICA_CMD_READ_WITHOUT_ENCRYPTION) {
+        uint16_t service = frame[11] | (frame[12] << 8);
+        uint8_t count = frame[13];
+        std::vector<uint16_t> blocks;
+        for (uint8_t i = 0, p = 14; i < count && p < length; i++) {
+            if (frame[p] & 0x80) {
+                blocks.push_back(frame[p + 1]);
+                p += 2;
+            } else {
+                blocks.push_back(frame[p + 1] | (frame[p + 2] << 8));
+                p += 3;
+            }
+        }
+
+        bool valid = frame[10] == 1 && service == 0x000B && count >= 1 && count <= tag->maxBlocks && blocks.size() == count;
+        for (size_t i = 0; i < blocks.size(); i++)
+            if ((size_t)(blocks[i] + 1) * 16 > tag->memory.size())
+                valid = false;
+
+        if (! valid) {
+            data.push_back(0xFF);
+            data.push_back(0xA1);
+        } else {
+            reads++;
+            data.push_back(0x00);
+            data.push_back(0x00);
+            data.push_back(count);
+            for (size_t i = 0; i < blocks.size(); i++)
+                data.insert(data.end(), &tag->memory[blocks[i] * 16], &tag->memory[blocks[i] * 16] + 16);
+        }
+    } else {
+        data.resize(1);
+        data[0] = 0x01;
+        reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+        return;
+    }
+    data[1] = data.size() - 1;
+    reply(PN532_COMMAND_INDATAEXCHANGE + 1, data);
+}
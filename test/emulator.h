@@ -0,0 +1,97 @@
+/**************************************************************************/
+/*!
+    @file     emulator.h
+    @license  BSD
+
+    A PN532 and the tags in its field, emulated on the host for the tests.
+    Commands are answered from memory as soon as they are sent, with the
+    frames the PN532 returns, and counted.
+
+    Simplifications: a key B the access bits leave readable still opens a
+    sector, and sector trailer access bits don't restrict reads or writes.
+
+*/
+/**************************************************************************/
+
+#ifndef __TEST_EMULATOR_INCLUDED__
+#define __TEST_EMULATOR_INCLUDED__
+
+#include "Mifare.h"
+#include <vector>
+#include <map>
+
+struct EmulatedTag{
+    uint32_t type;                  // MIFARE_CLASSIC, MIFARE_CLASSIC_4K, MIFARE_ULTRALIGHT or MIFARE_FELICA
+    uint8_t uid[10];                // the IDm of FeliCa tags
+    uint8_t uidLength;
+    std::vector<uint8_t> memory;    // classic blocks, ultralight pages, FeliCa blocks from the attribute block
+    std::vector<uint8_t> version;   // GET_VERSION answer, empty when the tag has none
+    uint16_t systemCode;            // FeliCa
+    uint8_t maxBlocks;              // FeliCa, blocks per Read Without Encryption
+    bool present;                   // in the field
+    bool halted;                    // needs InSelect or a new field
+    int authSector;                 // classic sector open, -1 for none
+};
+
+EmulatedTag * classicTag(uint32_t type, uint8_t uidByte, const uint8_t * keyA, const uint8_t * keyB);
+EmulatedTag * ultralightTag(uint8_t pages, uint8_t uidByte);
+EmulatedTag * ntagTag(uint8_t pages, uint8_t uidByte);
+EmulatedTag * felicaTag(const uint8_t * message, uint16_t length, uint8_t maxBlocks, uint16_t blocks);
+
+// sector trailer helpers, blocks of the trailer and first block of a sector
+uint16_t classicTrailer(uint8_t sector);
+uint8_t classicSectorOf(uint8_t block);
+
+// the frame the PN532 answers a command with, code is the command + 1
+void responseFrame(uint8_t code, const std::vector<uint8_t> & data, std::vector<uint8_t> & frame);
+
+class EmulatedBoard : public PN532{
+  public:
+    EmulatedBoard();
+
+    std::vector<EmulatedTag *> tags;     // in the field, in the order InListPassiveTarget finds them
+
+    // bus limits of the transport, the AVR Wire buffer gives 24 and 30
+    uint8_t commandLimit;
+    uint8_t responseLimit;
+    void limitToAvrI2C(void);
+
+    // counters, reset by clearCounters
+    int exchanges;          // commands sent
+    int authentications;    // classic AUTH_A / AUTH_B
+    int reads;              // READ, FAST_READ and Read Without Encryption
+    int writes;             // WRITE
+    int registerFrames;     // ReadRegister and WriteRegister
+    int overruns;           // commands or reads longer than the bus limits
+    void clearCounters(void);
+
+    std::map<uint16_t, uint8_t> registers;
+
+    void begin(void){}
+    uint32_t getFirmwareVersion(void){ return 0x32010607; }
+    boolean readack(void){ return true; }
+    boolean sendCommandCheckAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean sendCommandAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean waitready(uint16_t timeout = 1000){ return true; }
+    uint8_t readstatus(void){ return PN532_READY; }
+    void readdata(uint8_t * buff, uint8_t n);
+    void sendcommand(uint8_t * cmd, uint8_t cmdlen);
+    uint8_t commandlimit(void){ return commandLimit; }
+    uint8_t responselimit(void){ return responseLimit; }
+
+  private:
+    std::vector<int> listed;        // tag indexes by Tg - 1
+    int active;                     // tag the last command went to, -1 for none
+    std::vector<uint8_t> response;
+
+    void reply(uint8_t code, const std::vector<uint8_t> & data);
+    void handle(uint8_t * cmd, uint8_t length);
+    void listTargets(uint8_t * cmd);
+    void exchange(EmulatedTag * tag, uint8_t * frame, uint8_t length);
+    void classic(EmulatedTag * tag, uint8_t * frame, uint8_t length);
+    void ultralight(EmulatedTag * tag, uint8_t * frame, uint8_t length);
+    void felica(EmulatedTag * tag, uint8_t * frame, uint8_t length);
+    EmulatedTag * target(uint8_t tg);
+};
+
+#endif
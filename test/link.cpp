@@ -0,0 +1,246 @@
+/**************************************************************************/
+/*!
+    @file     link.cpp
+    @license  BSD
+
+    Two PN532s facing each other, emulated on the host, see link.h
+
+*/
+/**************************************************************************/
+
+#include "link.h"
+#include "emulator.h"
+#include "PeerToPeer.h"
+#include <chrono>
+
+// NFCID3 of the initiator and the target
+static const uint8_t nfcid3i[10] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9};
+static const uint8_t nfcid3t[10] = {0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9};
+
+/*
+ waits until ready holds, up to timeout ms, 0 waits forever. returns
+ false on a timeout
+ */
+template<class Predicate> static bool waitFor(LinkedField * field, std::unique_lock<std::mutex> & lock, uint16_t timeout, Predicate ready){
+    if (timeout == 0) {
+        field->changed.wait(lock, ready);
+        return true;
+    }
+    return field->changed.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+}
+
+
+LinkedField::LinkedField(){
+    listening = false;
+    picc = false;
+    activated = false;
+    linked = false;
+    released = false;
+    hasRequest = false;
+    hasResponse = false;
+    pp = 0x32;      // LR 254 bytes, general bytes
+    baudRate = P2P_106;
+    frames = 0;
+}
+
+
+LinkedBoard::LinkedBoard(LinkedField * field){
+    this->field = field;
+    commandLimit = PN532_FRAMESIZE - 1;
+    responseLimit = PN532_FRAMESIZE;
+    commands = 0;
+    overruns = 0;
+}
+
+// PN532_I2C on AVR, limited by the 32 byte Wire buffer
+void LinkedBoard::limitToAvrI2C(void){
+    commandLimit = 24;
+    responseLimit = 30;
+}
+
+boolean LinkedBoard::sendCommandCheckAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout){
+    sendcommand(cmd, cmdlen);
+    return answer(timeout);
+}
+
+boolean LinkedBoard::sendCommandAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout){
+    sendcommand(cmd, cmdlen);
+    return true;
+}
+
+boolean LinkedBoard::waitready(uint16_t timeout){
+    return answer(timeout);
+}
+
+void LinkedBoard::sendcommand(uint8_t * cmd, uint8_t cmdlen){
+    if (cmdlen > commandLimit)
+        overruns++;
+    commands++;
+    command.assign(cmd, cmd + cmdlen);
+    response.clear();
+}
+
+void LinkedBoard::readdata(uint8_t * buff, uint8_t n){
+    if (! command.empty())
+        answer(1000);
+    if (n > responseLimit)
+        overruns++;
+    for (uint8_t i = 0; i < n; i++)
+        buff[i] = (i < response.size()) ? response[i] : 0;
+}
+
+void LinkedBoard::reply(uint8_t code, const std::vector<uint8_t> & data){
+    responseFrame(code, data, response);
+}
+
+/*
+ runs the command sent last, waiting up to timeout ms for the other board
+ where the PN532 waits for the peer. returns false if the response doesn't
+ come, as waitready does
+ */
+boolean LinkedBoard::answer(uint16_t timeout){
+    if (command.empty())
+        return true;
+
+    std::vector<uint8_t> cmd;
+    cmd.swap(command);
+    std::unique_lock<std::mutex> lock(field->lock);
+    LinkedField * f = field;
+    std::vector<uint8_t> data;
+
+    switch (cmd[0]) {
+    case PN532_COMMAND_INJUMPFORDEP:
+        // status, Tg, NFCID3t, DIDt, BSt, BRt, TO, PPt
+        if (! waitFor(f, lock, timeout, [f]{ return f->listening && ! f->picc; }))
+            return false;
+        f->activated = true;
+        f->linked = true;
+        f->released = false;
+        f->baudRate = P2P_106;
+        f->changed.notify_all();
+        data.push_back(0x00);
+        data.push_back(0x01);
+        data.insert(data.end(), nfcid3t, nfcid3t + 10);
+        data.push_back(0x00);
+        data.push_back(0x00);
+        data.push_back(0x00);
+        data.push_back(0x0E);
+        data.push_back(f->pp);
+        break;
+
+    case PN532_COMMAND_INLISTPASSIVETARGET:
+        // one ISO14443-4 target: Tg, SENS_RES, SEL_RES, NFCID1, ATS
+        if (! waitFor(f, lock, timeout, [f]{ return f->listening && f->picc; })) {
+            data.push_back(0x00);
+            break;
+        }
+        f->activated = true;
+        f->linked = true;
+        f->released = false;
+        f->changed.notify_all();
+        {
+            static const uint8_t listed[] = {0x01, 0x01, 0x00, 0x04, 0x20, 0x04, 0x08, 0x12, 0x34, 0x56,
+                0x05, 0x75, 0x77, 0x81, 0x02};
+            data.assign(listed, listed + sizeof(listed));
+        }
+        break;
+
+    case PN532_COMMAND_INPSL:
+        f->baudRate = cmd[2];
+        data.push_back(f->linked ? 0x00 : 0x01);
+        break;
+
+    case PN532_COMMAND_INDATAEXCHANGE:
+        if (! f->linked) {
+            data.push_back(0x01);
+            break;
+        }
+        f->request.assign(cmd.begin() + 2, cmd.end());
+        f->hasRequest = true;
+        f->frames++;
+        f->changed.notify_all();
+        if (! waitFor(f, lock, timeout, [f]{ return f->hasResponse; })) {
+            f->hasRequest = false;
+            data.push_back(0x01);
+            break;
+        }
+        f->hasResponse = false;
+        data.push_back(0x00);
+        data.insert(data.end(), f->response.begin(), f->response.end());
+        break;
+
+    case PN532_COMMAND_INRELEASE:
+        f->linked = false;
+        f->released = true;
+        f->changed.notify_all();
+        data.push_back(0x00);
+        break;
+
+    case PN532_COMMAND_TGINITASTARGET:
+        f->listening = true;
+        f->picc = (cmd[1] & 0x04) != 0;
+        f->activated = false;
+        f->released = false;
+        f->hasRequest = false;
+        f->hasResponse = false;
+        f->changed.notify_all();
+        if (! waitFor(f, lock, timeout, [f]{ return f->activated; })) {
+            f->listening = false;
+            return false;
+        }
+        f->activated = false;
+        f->listening = false;
+        if (f->picc) {
+            // mode, then the RATS the PN532 answered
+            data.push_back(0x08);
+            data.push_back(0xE0);
+            data.push_back(0x80);
+        } else {
+            // mode, then ATR_REQ: length, D4 00, NFCID3i, DIDi, BSi, BRi, PPi
+            data.push_back(0x04);
+            data.push_back(17);
+            data.push_back(0xD4);
+            data.push_back(0x00);
+            data.insert(data.end(), nfcid3i, nfcid3i + 10);
+            data.push_back(0x00);
+            data.push_back(0x00);
+            data.push_back(0x00);
+            data.push_back(f->pp);
+        }
+        break;
+
+    case PN532_COMMAND_TGGETDATA:
+        if (! waitFor(f, lock, timeout, [f]{ return f->hasRequest || f->released; }))
+            return false;
+        if (! f->hasRequest) {
+            data.push_back(0x29);       // released by the initiator
+            break;
+        }
+        f->hasRequest = false;
+        data.push_back(0x00);
+        data.insert(data.end(), f->request.begin(), f->request.end());
+        break;
+
+    case PN532_COMMAND_TGSETDATA:
+        if (! f->linked) {
+            data.push_back(0x29);
+            break;
+        }
+        f->response.assign(cmd.begin() + 1, cmd.end());
+        f->hasResponse = true;
+        f->frames++;
+        f->changed.notify_all();
+        data.push_back(0x00);
+        break;
+
+    case PN532_COMMAND_SETPARAMETERS:
+        break;
+
+    default:
+        data.push_back(0x00);
+        break;
+    }
+
+    reply(cmd[0] + 1, data);
+    return true;
+}
@@ -0,0 +1,83 @@
+/**************************************************************************/
+/*!
+    @file     link.h
+    @license  BSD
+
+    Two PN532s facing each other, emulated on the host for the peer to
+    peer and card emulation tests. Each board runs in its own thread, a
+    command waits on the shared field for the other side like the PN532
+    waits on the air: InJumpForDEP or InListPassiveTarget for a
+    TgInitAsTarget, TgGetData for an InDataExchange, InDataExchange for
+    the TgSetData that answers it.
+
+    Only what PeerToPeer, TagEmulator and Mifare's type 4 reader send is
+    emulated. The target side is activated at once, without RF timing.
+
+*/
+/**************************************************************************/
+
+#ifndef __TEST_LINK_INCLUDED__
+#define __TEST_LINK_INCLUDED__
+
+#include "PN532_Com.h"
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// the air between the boards, guarded by lock
+struct LinkedField{
+    LinkedField();
+
+    std::mutex lock;
+    std::condition_variable changed;
+
+    bool listening;                 // a target waits in TgInitAsTarget
+    bool picc;                      // as an ISO14443-4 card, else as a DEP target
+    bool activated;                 // an initiator answered the TgInitAsTarget
+    bool linked;                    // the initiator may exchange data
+    bool released;                  // InRelease, pending TgGetData fail
+    bool hasRequest;                // an InDataExchange waits for TgGetData
+    bool hasResponse;               // a TgSetData waits for the InDataExchange
+    std::vector<uint8_t> request;
+    std::vector<uint8_t> response;
+
+    uint8_t pp;                     // PP byte of ATR_REQ and ATR_RES, LR in bits 4..5
+    uint8_t baudRate;               // P2P_106 until InPSL
+
+    int frames;                     // DEP frames: requests and their responses
+};
+
+class LinkedBoard : public PN532{
+  public:
+    LinkedBoard(LinkedField * field);
+
+    // bus limits of the transport, the AVR Wire buffer gives 24 and 30
+    uint8_t commandLimit;
+    uint8_t responseLimit;
+    void limitToAvrI2C(void);
+
+    int commands;           // commands sent
+    int overruns;           // commands or reads longer than the bus limits
+
+    void begin(void){}
+    uint32_t getFirmwareVersion(void){ return 0x32010607; }
+    boolean readack(void){ return true; }
+    boolean sendCommandCheckAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean sendCommandAck(uint8_t * cmd, uint8_t cmdlen, uint16_t timeout = 1000);
+    boolean waitready(uint16_t timeout = 1000);
+    uint8_t readstatus(void){ return PN532_READY; }
+    void readdata(uint8_t * buff, uint8_t n);
+    void sendcommand(uint8_t * cmd, uint8_t cmdlen);
+    uint8_t commandlimit(void){ return commandLimit; }
+    uint8_t responselimit(void){ return responseLimit; }
+
+  private:
+    LinkedField * field;
+    std::vector<uint8_t> command;   // sent, not answered yet
+    std::vector<uint8_t> response;
+
+    void reply(uint8_t code, const std::vector<uint8_t> & data);
+    boolean answer(uint16_t timeout);
+};
+
+#endif
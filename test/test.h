@@ -0,0 +1,44 @@
+/**************************************************************************/
+/*!
+    @file     test.h
+    @license  BSD
+
+    Checks for the host tests: CHECK counts and reports failures, report()
+    prints the total and gives the exit code of the test.
+
+*/
+/**************************************************************************/
+
+#ifndef __TEST_TEST_INCLUDED__
+#define __TEST_TEST_INCLUDED__
+
+#include <stdio.h>
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        checks++; \
+        if (! (condition)) { \
+            failures++; \
+            printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            fflush(stdout); \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual) do { \
+        checks++; \
+        long e_ = (long)(expected), a_ = (long)(actual); \
+        if (e_ != a_) { \
+            failures++; \
+            printf("%s:%d: failed: %s is %ld, expected %ld\n", __FILE__, __LINE__, #actual, a_, e_); \
+            fflush(stdout); \
+        } \
+    } while (0)
+
+static int report(const char * name){
+    printf("%s: %d checks, %d failed\n", name, checks, failures);
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/**************************************************************************/
+/*!
+    @file     test_differential_write.cpp
+    @license  BSD
+
+    MIFARE_WRITE_DIFFERENTIAL rewrites only what changed: one byte of a
+    200 byte message is one WRITE on a Classic 1K and on an ultralight,
+    an unchanged message none. A new key B is written to the trailers even
+    though the access bits hide it.
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+#include "test.h"
+
+EmulatedBoard emulated;
+PN532 * board = &emulated;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+static const uint8_t factoryKey[6] = MIFARE_KEY_DEFAULT;
+
+Mifare mifare;
+uint8_t payload[200];
+
+// WRITEs taken by a payload write
+static int writePayload(MIFARE_SESSION * session){
+    emulated.clearCounters();
+    CHECK(mifare.writePayload(session, payload, sizeof(payload)));
+    return emulated.writes;
+}
+
+static void oneByteChanged(EmulatedTag * tag, int fullWrites){
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+
+    mifare.setWriteMode(MIFARE_WRITE_FULL);
+    writePayload(session);
+    payload[100] ^= 0xFF;
+    CHECK_EQUAL(fullWrites, writePayload(session));
+
+    mifare.setWriteMode(MIFARE_WRITE_DIFFERENTIAL);
+    payload[100] ^= 0xFF;
+    CHECK_EQUAL(1, writePayload(session));
+    CHECK_EQUAL(0, writePayload(session));
+
+    uint8_t output[256];
+    CHECK(mifare.readPayload(session, output, sizeof(output)));
+    CHECK(memcmp(output, payload, sizeof(payload) - 2) == 0);
+    mifare.release(session);
+}
+
+/*
+ key B rotated with the old key in the dictionary: the payload takes
+ sectors 1..5 of a 1K card and their trailers get the new key B, which
+ the access bits of the NDEF sectors hide
+ */
+static void newKeyB(void){
+    static const uint8_t newKey[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+    static const MIFARE_KEY keys[2] = {{KEY_B, MIFARE_KEY_DEFAULT}, {KEY_B, {0x11, 0x22, 0x33, 0x44, 0x55, 0x66}}};
+    EmulatedTag * tag = classicTag(MIFARE_CLASSIC, 0x20, factoryKey, factoryKey);
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+
+    mifare.setWriteMode(MIFARE_WRITE_DIFFERENTIAL);
+    writePayload(session);
+    CHECK_EQUAL(0, writePayload(session));
+
+    mifare.setKeyDictionary(keys, 2);
+    memcpy(Mifare::keyB, newKey, 6);
+    CHECK_EQUAL(5, writePayload(session));
+    for (uint8_t sector = 1; sector <= 5; sector++)
+        CHECK(memcmp(&tag->memory[classicTrailer(sector) * 16 + 10], newKey, 6) == 0);
+    CHECK_EQUAL(0, writePayload(session));
+
+    mifare.setKeyDictionary(0, 0);
+    memcpy(Mifare::keyB, factoryKey, 6);
+    mifare.release(session);
+    delete tag;
+}
+
+int main(void){
+    memset(payload, 0, sizeof(payload));
+    payload[0] = NDEF_TLV_MESSAGE;
+    payload[1] = sizeof(payload) - 4;
+    for (uint8_t i = 2; i < sizeof(payload) - 2; i++)
+        payload[i] = i;
+    payload[sizeof(payload) - 2] = NDEF_TLV_TERMINATOR;
+
+    EmulatedTag * tag = classicTag(MIFARE_CLASSIC, 0x10, factoryKey, factoryKey);
+    oneByteChanged(tag, 20);
+    delete tag;
+
+    tag = ultralightTag(64, 0x30);
+    oneByteChanged(tag, 50);
+    delete tag;
+
+    newKeyB();
+    return report("differential_write");
+}
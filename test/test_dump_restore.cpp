@@ -0,0 +1,167 @@
+/**************************************************************************/
+/*!
+    @file     test_dump_restore.cpp
+    @license  BSD
+
+    dump images a tag and restore writes the image to another one of the
+    same type, which then holds the same memory apart from the UID. A
+    second restore writes nothing. NTAG21x are identified with GET_VERSION
+    through InCommunicateThru and dumped with FAST_READ: an NTAG213 in 5
+    exchanges, an NTAG216 in 19, and in 48 over I2C with the AVR Wire
+    buffer. A Classic 1K takes one authentication per sector and one more
+    for the key A that doesn't read back.
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+#include "NDEF.h"
+#include "test.h"
+
+EmulatedBoard emulated;
+PN532 * board = &emulated;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+static const uint8_t factoryKey[6] = MIFARE_KEY_DEFAULT;
+
+Mifare mifare;
+std::vector<uint8_t> image;
+
+// what the last dump cost
+int exchanges, authentications, reads;
+
+static boolean store(uint8_t * data, uint8_t length, uint16_t offset, void * context){
+    if (image.size() < offset + length)
+        image.resize(offset + length);
+    memcpy(&image[offset], data, length);
+    return true;
+}
+
+static boolean load(uint8_t * data, uint8_t length, uint16_t offset, void * context){
+    if (offset + length > image.size())
+        return false;
+    memcpy(data, &image[offset], length);
+    return true;
+}
+
+// writes a text message to tag and dumps it
+static void dumpTag(EmulatedTag * tag){
+    uint8_t message[200];
+    strcpy((char *)message, "a message that takes a few blocks, or pages, of the tag's memory");
+    uint16_t length = NDEF().encode_TEXT((uint8_t *)"en", message);
+
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(mifare.writePayload(session, message, length));
+
+    image.clear();
+    emulated.clearCounters();
+    CHECK(mifare.dump(session, store, 0));
+    exchanges = emulated.exchanges;
+    authentications = emulated.authentications;
+    reads = emulated.reads;
+    CHECK_EQUAL(MIFARE_IMAGE_HEADER + tag->memory.size(), image.size());
+    CHECK_EQUAL(MIFARE_IMAGE_VERSION, image[0]);
+    CHECK_EQUAL(0, emulated.overruns);
+    mifare.release(session);
+}
+
+/*
+ restores the image onto blank, which then matches original from from
+ on, and again, which writes nothing
+ */
+static void restoreTag(EmulatedTag * original, EmulatedTag * blank, uint16_t from){
+    emulated.tags.assign(1, blank);
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(mifare.restore(session, load, 0));
+    CHECK(memcmp(&blank->memory[from], &original->memory[from], original->memory.size() - from) == 0);
+
+    emulated.clearCounters();
+    CHECK(mifare.restore(session, load, 0));
+    CHECK_EQUAL(0, emulated.writes);
+    mifare.release(session);
+}
+
+static int fastReads(uint8_t pages){
+    uint8_t frame = (emulated.responseLimit < MIFARE_PACKBUFFSIZE) ? emulated.responseLimit : MIFARE_PACKBUFFSIZE;
+    uint8_t count = (frame - 10) / 4;
+    return (pages + count - 1) / count;
+}
+
+// GET_VERSION, then the whole memory with FAST_READ
+static void ntag(uint8_t pages){
+    EmulatedTag * tag = ntagTag(pages, 0x10);
+    dumpTag(tag);
+    CHECK(memcmp(&image[MIFARE_IMAGE_HEADER], &tag->memory[0], tag->memory.size()) == 0);
+    CHECK_EQUAL(1 + fastReads(pages), exchanges);
+    CHECK_EQUAL(fastReads(pages), reads);
+
+    // lock bits go over too, the UID bytes of page 2 don't
+    EmulatedTag * blank = ntagTag(pages, 0x40);
+    uint16_t dynamicLock = (pages - 5) * 4;
+    tag->memory[11] |= 0x01;
+    tag->memory[dynamicLock] |= 0x0F;
+    image[MIFARE_IMAGE_HEADER + 11] |= 0x01;
+    image[MIFARE_IMAGE_HEADER + dynamicLock] |= 0x0F;
+    restoreTag(tag, blank, 10);
+    delete blank;
+    delete tag;
+}
+
+/*
+ the trailers of the image hold key B, read back, and key A where keyA
+ opens the sector: the 2 NDEF sectors. the others keep zeros, the MAD
+ key and the factory key are filled in by hand
+ */
+static void classic(void){
+    static const uint8_t madKey[6] = MIFARE_KEY_MAD;
+    static const uint8_t zeros[6] = {0, 0, 0, 0, 0, 0};
+    EmulatedTag * tag = classicTag(MIFARE_CLASSIC, 0x10, factoryKey, factoryKey);
+    dumpTag(tag);
+    CHECK_EQUAL(32, authentications);
+    for (uint8_t sector = 0; sector < 16; sector++) {
+        uint8_t * key = &image[MIFARE_IMAGE_HEADER + classicTrailer(sector) * 16];
+        CHECK(memcmp(key, (sector == 1 || sector == 2) ? Mifare::keyA : zeros, 6) == 0);
+        if (sector == 0)
+            memcpy(key, madKey, 6);
+        else if (sector > 2)
+            memcpy(key, factoryKey, 6);
+    }
+    CHECK(memcmp(&image[MIFARE_IMAGE_HEADER], &tag->memory[0], tag->memory.size()) == 0);
+
+    EmulatedTag * blank = classicTag(MIFARE_CLASSIC, 0x40, factoryKey, factoryKey);
+    restoreTag(tag, blank, 16);
+    delete blank;
+    delete tag;
+}
+
+// an image of another card type is refused before anything is written
+static void wrongType(void){
+    EmulatedTag * tag = ntagTag(45, 0x10);
+    dumpTag(tag);
+    delete tag;
+
+    tag = classicTag(MIFARE_CLASSIC, 0x40, factoryKey, factoryKey);
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+    emulated.clearCounters();
+    CHECK(! mifare.restore(session, load, 0));
+    CHECK_EQUAL(0, emulated.writes);
+    mifare.release(session);
+    delete tag;
+}
+
+int main(void){
+    ntag(45);
+    ntag(231);
+    classic();
+    wrongType();
+
+    emulated.limitToAvrI2C();
+    ntag(231);
+    return report("dump_restore");
+}
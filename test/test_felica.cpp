@@ -0,0 +1,130 @@
+/**************************************************************************/
+/*!
+    @file     test_felica.cpp
+    @license  BSD
+
+    Type 3 NDEF messages stream from a FeliCa tag with as many blocks per
+    Read Without Encryption as the tag (Nbr) and packetbuffer allow: 2 at
+    the default MIFARE_PACKBUFFSIZE, 14 when the tests are built with
+    CPPFLAGS=-DMIFARE_PACKBUFFSIZE=255. Lengths around 4096 bytes, where the
+    blocks left no longer fit 8 bits, read through. Over I2C with the AVR
+    Wire buffer a block doesn't fit a response and reads fail up front.
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+#include "test.h"
+
+EmulatedBoard emulated;
+PN532 * board = &emulated;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+Mifare mifare;
+uint8_t message[5000];
+
+// what streamPayload handed over
+struct RECEIVED{
+    uint16_t length;
+    uint16_t total;
+    uint8_t largest;        // longest chunk
+    boolean match;
+};
+
+static boolean collect(uint8_t * data, uint8_t length, uint16_t offset, uint16_t total, void * context){
+    RECEIVED * received = (RECEIVED *) context;
+    if (offset != received->length || memcmp(data, message + offset, length) != 0)
+        received->match = false;
+    received->length += length;
+    received->total = total;
+    if (length > received->largest)
+        received->largest = length;
+    return true;
+}
+
+/*
+ streams a message of length bytes from a tag reading maxBlocks blocks
+ at a time, checks what arrived and the Read Without Encryption count
+ */
+static void stream(uint16_t length, uint8_t maxBlocks, uint8_t expectedBatch){
+    EmulatedTag * tag = felicaTag(message, length, maxBlocks, length / 16 + 8);
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detectFeliCa();
+    CHECK(session != 0);
+    CHECK_EQUAL(MIFARE_FELICA, Mifare::cardType);
+
+    RECEIVED received = {0, 0, 0, true};
+    emulated.clearCounters();
+    CHECK(mifare.streamPayload(session, collect, &received));
+    CHECK_EQUAL(length, received.length);
+    CHECK_EQUAL(length, received.total);
+    CHECK(received.match);
+    CHECK_EQUAL((length < expectedBatch * 16) ? length : expectedBatch * 16, received.largest);
+
+    // the attribute block, then the message expectedBatch blocks at a time
+    uint16_t blocks = (length + 15) / 16;
+    CHECK_EQUAL(1 + (blocks + expectedBatch - 1) / expectedBatch, emulated.reads);
+    CHECK_EQUAL(0, emulated.overruns);
+
+    mifare.release(session);
+    delete tag;
+}
+
+/*
+ readFeliCaBlocks splits a read in batches, and goes on one block at a
+ time with a tag that refuses several
+ */
+static void blocks(uint8_t maxBlocks, int expectedReads){
+    EmulatedTag * tag = felicaTag(message, 100, maxBlocks, 16);
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detectFeliCa();
+
+    uint8_t output[5 * 16];
+    emulated.clearCounters();
+    CHECK(mifare.readFeliCaBlocks(session, FELICA_SERVICE_NDEF_READ, 1, 5, output));
+    CHECK(memcmp(output, message, sizeof(output)) == 0);
+    CHECK_EQUAL(expectedReads, emulated.reads);
+
+    mifare.release(session);
+    delete tag;
+}
+
+// the 39 byte response of a single block doesn't fit the AVR Wire buffer
+static void avrI2C(void){
+    EmulatedTag * tag = felicaTag(message, 100, 4, 16);
+    emulated.tags.assign(1, tag);
+    emulated.limitToAvrI2C();
+    MIFARE_SESSION * session = mifare.detectFeliCa();
+    CHECK(session != 0);
+
+    RECEIVED received = {0, 0, 0, true};
+    emulated.clearCounters();
+    CHECK(! mifare.streamPayload(session, collect, &received));
+    CHECK_EQUAL(0, emulated.reads);
+    CHECK_EQUAL(0, emulated.overruns);
+
+    mifare.release(session);
+    delete tag;
+}
+
+int main(void){
+    for (uint16_t i = 0; i < sizeof(message); i++)
+        message[i] = rand();
+
+    CHECK_EQUAL((MIFARE_PACKBUFFSIZE - 23) / 16, FELICA_MAX_BLOCKS);
+    stream(100, 15, FELICA_MAX_BLOCKS);
+    stream(100, 1, 1);
+    stream(4000, 15, FELICA_MAX_BLOCKS);
+    stream(4081, 15, FELICA_MAX_BLOCKS);
+    stream(4090, 15, FELICA_MAX_BLOCKS);
+    stream(4096, 15, FELICA_MAX_BLOCKS);
+    stream(4500, 15, FELICA_MAX_BLOCKS);
+    blocks(15, (5 + FELICA_MAX_BLOCKS - 1) / FELICA_MAX_BLOCKS);
+    blocks(1, 5);
+    avrI2C();
+    return report("felica");
+}
@@ -0,0 +1,151 @@
+/**************************************************************************/
+/*!
+    @file     test_large_payload.cpp
+    @license  BSD
+
+    Messages longer than a sector and 255 bytes round trip through
+    writePayload, readPayload and NDEF_Stream on an NTAG216 (830 byte MIME)
+    and a Classic 4K (1200 byte MIME), and examples/large_payload's 800
+    character TEXT on both. Over SPI and over I2C with the AVR Wire buffer.
+    An NTAG216 has 872 bytes for NDEF: 850 bytes of MIME is refused.
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+#include "NDEF.h"
+#include "test.h"
+
+EmulatedBoard emulated;
+PN532 * board = &emulated;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+static const uint8_t factoryKey[6] = MIFARE_KEY_DEFAULT;
+
+// what NDEF_Stream handed over, compared with the payload written
+struct STREAMED{
+    const uint8_t * expected;
+    uint32_t length;        // payload length of the record
+    uint32_t received;
+    boolean match;
+};
+
+static void compareRecord(NDEF_RECORD * record, uint8_t * data, uint8_t length, uint32_t offset, void * context){
+    STREAMED * streamed = (STREAMED *) context;
+    streamed->length = record->payloadLength;
+    if (memcmp(data, streamed->expected + offset, length) != 0)
+        streamed->match = false;
+    streamed->received += length;
+}
+
+static EmulatedTag * newTag(uint32_t type){
+    if (type == MIFARE_ULTRALIGHT)
+        return ntagTag(231, 0x10);
+    return classicTag(type, 0x20, factoryKey, factoryKey);
+}
+
+/*
+ a MIME record of size random bytes, read back whole with readPayload
+ and in pieces with NDEF_Stream
+ */
+static void mimeRoundTrip(uint32_t type, uint16_t size){
+    static uint8_t data[1400], message[1400], output[1400];
+    for (uint16_t i = 0; i < size; i++)
+        data[i] = rand();
+    memcpy(message, data, size);
+    uint16_t length = NDEF().encode_MIME((uint8_t *)"application/octet-stream", message, size);
+    CHECK(length > size + 24);
+
+    emulated.tags.assign(1, newTag(type));
+    emulated.clearCounters();
+    Mifare mifare;
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(session != 0);
+    CHECK_EQUAL(type, Mifare::cardType);
+    CHECK(mifare.writePayload(session, message, length));
+
+    memset(output, 0, sizeof(output));
+    CHECK(mifare.readPayload(session, output, sizeof(output)));
+    FOUND_MESSAGE found = NDEF().decode_message(output);
+    CHECK_EQUAL(NDEF_TYPE_MIME, found.type);
+    CHECK(found.format && strcmp(found.format, "application/octet-stream") == 0);
+    CHECK_EQUAL(size, found.length);
+    CHECK(found.payload && memcmp(found.payload, data, size) == 0);
+
+    STREAMED streamed = {data, 0, 0, true};
+    NDEF_Stream stream(compareRecord, &streamed);
+    CHECK(mifare.streamPayload(session, NDEF_Stream::consume, &stream));
+    CHECK(stream.complete());
+    CHECK_EQUAL(size, streamed.length);
+    CHECK_EQUAL(size, streamed.received);
+    CHECK(streamed.match);
+
+    CHECK_EQUAL(0, emulated.overruns);
+    delete emulated.tags[0];
+}
+
+// examples/large_payload: 800 characters of TEXT, an 815 byte TLV
+static void textRoundTrip(uint32_t type){
+    static uint8_t text[803], message[820];
+    text[0] = 0x02;
+    text[1] = 'e';
+    text[2] = 'n';
+    for (uint16_t i = 0; i < 800; i++)
+        text[3 + i] = 'a' + (i % 26);
+    memcpy(message, text + 3, 800);
+    message[800] = 0;
+    uint16_t length = NDEF().encode_TEXT((uint8_t *)"en", message);
+    CHECK_EQUAL(815, length);
+
+    emulated.tags.assign(1, newTag(type));
+    emulated.clearCounters();
+    Mifare mifare;
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(mifare.writePayload(session, message, length));
+
+    STREAMED streamed = {text, 0, 0, true};
+    NDEF_Stream stream(compareRecord, &streamed);
+    CHECK(mifare.streamPayload(session, NDEF_Stream::consume, &stream));
+    CHECK(stream.complete());
+    CHECK_EQUAL(803, streamed.length);
+    CHECK_EQUAL(803, streamed.received);
+    CHECK(streamed.match);
+
+    CHECK_EQUAL(0, emulated.overruns);
+    delete emulated.tags[0];
+}
+
+// 850 bytes of MIME make an 885 byte TLV, the write fails before touching the tag
+static void tooLarge(void){
+    static uint8_t message[900];
+    memset(message, 0x55, 850);
+    uint16_t length = NDEF().encode_MIME((uint8_t *)"application/octet-stream", message, 850);
+    CHECK_EQUAL(885, length);
+
+    emulated.tags.assign(1, newTag(MIFARE_ULTRALIGHT));
+    emulated.clearCounters();
+    Mifare mifare;
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(! mifare.writePayload(session, message, length));
+    CHECK_EQUAL(0, emulated.writes);
+    delete emulated.tags[0];
+}
+
+int main(void){
+    for (uint8_t i2c = 0; i2c < 2; i2c++) {
+        if (i2c)
+            emulated.limitToAvrI2C();
+
+        mimeRoundTrip(MIFARE_ULTRALIGHT, 830);
+        mimeRoundTrip(MIFARE_CLASSIC_4K, 1200);
+        mimeRoundTrip(MIFARE_CLASSIC, 500);
+        textRoundTrip(MIFARE_ULTRALIGHT);
+        textRoundTrip(MIFARE_CLASSIC_4K);
+    }
+    tooLarge();
+    return report("large_payload");
+}
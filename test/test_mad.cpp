@@ -0,0 +1,213 @@
+/**************************************************************************/
+/*!
+    @file     test_mad.cpp
+    @license  BSD
+
+    Writing NDEF to a classic card whose MAD lists other applications
+    gives NDEF free sectors only and keeps the others, their data and a
+    valid MAD CRC. A card without enough free sectors isn't touched. On a
+    4K card sectors 17..39 are used only with a valid MAD2.
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+#include "test.h"
+
+EmulatedBoard emulated;
+PN532 * board = &emulated;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+static const uint8_t factoryKey[6] = MIFARE_KEY_DEFAULT;
+
+Mifare mifare;
+
+// CRC-8 of the MAD, polynomial 0x1D from 0xC7
+static uint8_t madCrc(const uint8_t * data, uint8_t length){
+    uint8_t crc = 0xC7;
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t b = 0; b < 8; b++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+    }
+    return crc;
+}
+
+// AID of sector in the MAD of tag, stored high byte first like 03 E1
+static uint16_t aidOf(EmulatedTag * tag, uint8_t sector){
+    const uint8_t * aid = (sector < 16) ? &tag->memory[16 + sector * 2] : &tag->memory[64 * 16 + (sector - 16) * 2];
+    return (aid[0] << 8) | aid[1];
+}
+
+static void setAid(EmulatedTag * tag, uint8_t sector, uint16_t aid){
+    uint8_t * entry = (sector < 16) ? &tag->memory[16 + sector * 2] : &tag->memory[64 * 16 + (sector - 16) * 2];
+    entry[0] = aid >> 8;
+    entry[1] = aid;
+}
+
+static boolean madValid(EmulatedTag * tag){
+    return madCrc(&tag->memory[17], 31) == tag->memory[16];
+}
+
+static boolean mad2Valid(EmulatedTag * tag){
+    return madCrc(&tag->memory[64 * 16 + 1], 47) == tag->memory[64 * 16];
+}
+
+/*
+ a card with a MAD giving sectors 1..used to another application (AID
+ 4801), which filled its first block with 0xAB. sector 16 of a 4K card
+ holds a valid MAD2 with every sector free when mad2 is set
+ */
+static EmulatedTag * applicationCard(uint32_t type, uint8_t used, boolean mad2){
+    EmulatedTag * tag = classicTag(type, 0x10, factoryKey, factoryKey);
+    tag->memory[17] = 0x01;
+    for (uint8_t sector = 1; sector <= used; sector++) {
+        setAid(tag, sector, 0x4801);
+        memset(&tag->memory[sector * 64], 0xAB, 16);
+    }
+    tag->memory[16] = madCrc(&tag->memory[17], 31);
+    tag->memory[classicTrailer(0) * 16 + 9] = (type == MIFARE_CLASSIC_4K) ? 0xC2 : 0xC1;
+    if (mad2) {
+        tag->memory[64 * 16 + 1] = 0x01;
+        tag->memory[64 * 16] = madCrc(&tag->memory[64 * 16 + 1], 47);
+    }
+    return tag;
+}
+
+// a TLV holding length bytes of message, the TLV header and terminator included
+static uint16_t message(uint8_t * tlv, uint16_t length){
+    uint16_t size = length - 5;
+    tlv[0] = NDEF_TLV_MESSAGE;
+    tlv[1] = 0xFF;
+    tlv[2] = size >> 8;
+    tlv[3] = size;
+    for (uint16_t i = 0; i < size; i++)
+        tlv[4 + i] = i;
+    tlv[4 + size] = NDEF_TLV_TERMINATOR;
+    return length;
+}
+
+static boolean roundTrip(MIFARE_SESSION * session, uint8_t * tlv, uint16_t length){
+    static uint8_t output[2000];
+    if (! mifare.readPayload(session, output, sizeof(output)))
+        return false;
+    return memcmp(output, tlv, length - 1) == 0;
+}
+
+static void otherApplication(void){
+    static uint8_t tlv[300];
+    EmulatedTag * tag = applicationCard(MIFARE_CLASSIC, 3, false);
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+
+    // 300 bytes take 7 sectors of 48
+    uint16_t length = message(tlv, sizeof(tlv));
+    CHECK(mifare.writePayload(session, tlv, length));
+    for (uint8_t sector = 1; sector <= 3; sector++) {
+        CHECK_EQUAL(0x4801, aidOf(tag, sector));
+        CHECK_EQUAL(0xAB, tag->memory[sector * 64]);
+    }
+    for (uint8_t sector = 4; sector <= 10; sector++)
+        CHECK_EQUAL(0x03E1, aidOf(tag, sector));
+    for (uint8_t sector = 11; sector < 16; sector++)
+        CHECK_EQUAL(0, aidOf(tag, sector));
+    CHECK(madValid(tag));
+    CHECK(roundTrip(session, tlv, length));
+    mifare.release(session);
+
+    // a new session finds the NDEF sectors through the MAD
+    tag->halted = false;
+    session = mifare.detect();
+    CHECK(roundTrip(session, tlv, length));
+    mifare.release(session);
+    delete tag;
+}
+
+// 2 free sectors hold 96 bytes, 200 don't fit and nothing is written
+static void noRoom(void){
+    static uint8_t tlv[200];
+    EmulatedTag * tag = applicationCard(MIFARE_CLASSIC, 13, false);
+    std::vector<uint8_t> before = tag->memory;
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+
+    emulated.clearCounters();
+    CHECK(! mifare.writePayload(session, tlv, message(tlv, sizeof(tlv))));
+    CHECK_EQUAL(0, emulated.writes);
+    CHECK(tag->memory == before);
+    mifare.release(session);
+    delete tag;
+}
+
+/*
+ a 4K card with sectors 1..10 taken. without MAD2 the 5 free sectors
+ below 16 hold 240 bytes, with a valid MAD2 the message goes on in the
+ free sectors from 17
+ */
+static void extended(void){
+    static uint8_t tlv[1000];
+    uint16_t length = message(tlv, sizeof(tlv));
+
+    EmulatedTag * tag = applicationCard(MIFARE_CLASSIC_4K, 10, false);
+    std::vector<uint8_t> before = tag->memory;
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(! mifare.writePayload(session, tlv, length));
+    CHECK(tag->memory == before);
+    CHECK(mifare.writePayload(session, tlv, 200));
+    CHECK(! mad2Valid(tag));
+    for (uint8_t sector = 11; sector < 16; sector++)
+        CHECK_EQUAL(0x03E1, aidOf(tag, sector));
+    mifare.release(session);
+    delete tag;
+
+    // 240 + 6 * 48 + 2 * 240 = 1008 bytes: sectors 11..15, 17..22 and 32..33
+    tag = applicationCard(MIFARE_CLASSIC_4K, 10, true);
+    for (uint8_t sector = 23; sector < 32; sector++)
+        setAid(tag, sector, 0x4801);
+    tag->memory[64 * 16] = madCrc(&tag->memory[64 * 16 + 1], 47);
+    emulated.tags.assign(1, tag);
+    session = mifare.detect();
+    CHECK(mifare.writePayload(session, tlv, length));
+    CHECK(madValid(tag));
+    CHECK(mad2Valid(tag));
+    for (uint8_t sector = 17; sector <= 22; sector++)
+        CHECK_EQUAL(0x03E1, aidOf(tag, sector));
+    CHECK_EQUAL(0x4801, aidOf(tag, 23));
+    CHECK_EQUAL(0x03E1, aidOf(tag, 32));
+    CHECK_EQUAL(0x03E1, aidOf(tag, 33));
+    CHECK_EQUAL(0, aidOf(tag, 34));
+    CHECK(roundTrip(session, tlv, length));
+    mifare.release(session);
+    delete tag;
+}
+
+// a card without a valid MAD is formatted with every sector for NDEF
+static void blankCard(void){
+    static uint8_t tlv[1500];
+    EmulatedTag * tag = classicTag(MIFARE_CLASSIC_4K, 0x20, factoryKey, factoryKey);
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+    uint16_t length = message(tlv, sizeof(tlv));
+    CHECK(mifare.writePayload(session, tlv, length));
+    CHECK(madValid(tag));
+    CHECK(mad2Valid(tag));
+    for (uint8_t sector = 1; sector < 40; sector++)
+        if (sector != 16)
+            CHECK_EQUAL(0x03E1, aidOf(tag, sector));
+    CHECK(roundTrip(session, tlv, length));
+    mifare.release(session);
+    delete tag;
+}
+
+int main(void){
+    otherApplication();
+    noRoom();
+    extended();
+    blankCard();
+    return report("mad");
+}
@@ -0,0 +1,151 @@
+/**************************************************************************/
+/*!
+    @file     test_peer_to_peer.cpp
+    @license  BSD
+
+    4 KB from the initiator and 2 KB back over two linked PN532s arrive
+    whole and in order, in chunks that fill the host frame: 53 bytes, 234
+    DEP frames at the default P2P_BUFFSIZE, 244 bytes and 52 frames when
+    the tests are built with CPPFLAGS=-DP2P_BUFFSIZE=255. An initiator on
+    I2C with the AVR Wire buffer moves 19 byte chunks both ways, a target
+    there fails up front.
+
+*/
+/**************************************************************************/
+
+#include "link.h"
+#include "PeerToPeer.h"
+#include "Mifare.h"
+#include "test.h"
+#include <thread>
+
+PN532 * board = 0;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+uint8_t blob[6144];
+
+// what receive handed over
+struct RECEIVED{
+    const uint8_t * expected;
+    uint32_t length;
+    uint32_t stopAt;        // the callback refuses the chunk at this offset
+    uint8_t largest;        // longest chunk
+    boolean match;
+};
+
+static boolean collect(uint8_t * data, uint8_t length, uint32_t offset, void * context){
+    RECEIVED * received = (RECEIVED *) context;
+    if (offset >= received->stopAt)
+        return false;
+    if (offset != received->length || memcmp(data, received->expected + offset, length) != 0)
+        received->match = false;
+    received->length += length;
+    if (length > received->largest)
+        received->largest = length;
+    return true;
+}
+
+static int chunks(uint32_t length, uint8_t chunkSize){
+    return (length + chunkSize - 1) / chunkSize;
+}
+
+/*
+ the initiator sends 4096 bytes and pulls 2048 back at baudRate, each
+ chunk is a request and its response
+ */
+static void transfer(uint8_t baudRate, boolean initiatorOnI2C, uint8_t expectedChunk){
+    LinkedField field;
+    LinkedBoard initiatorBoard(&field), targetBoard(&field);
+    if (initiatorOnI2C)
+        initiatorBoard.limitToAvrI2C();
+    PeerToPeer initiator(&initiatorBoard), target(&targetBoard);
+
+    RECEIVED atTarget = {blob, 0, 0xFFFFFFFF, 0, true};
+    RECEIVED atInitiator = {blob + 4096, 0, 0xFFFFFFFF, 0, true};
+    boolean received = false, sent = false;
+    uint32_t length = 0;
+
+    std::thread peer([&]{
+        if (! target.listen(2000))
+            return;
+        received = target.receive(collect, &atTarget, &length);
+        sent = target.send(blob + 4096, 2048);
+    });
+    CHECK(initiator.initiate(baudRate, 2000));
+    CHECK_EQUAL(P2P_ROLE_INITIATOR, initiator.getRole());
+    CHECK_EQUAL(baudRate, field.baudRate);
+    CHECK_EQUAL(expectedChunk, initiator.getChunkSize());
+
+    field.frames = 0;
+    uint32_t back = 0;
+    CHECK(initiator.send(blob, 4096));
+    CHECK(initiator.receive(collect, &atInitiator, &back));
+    int frames = field.frames;
+    CHECK(initiator.release());
+    peer.join();
+
+    CHECK(received);
+    CHECK(sent);
+    CHECK_EQUAL(4096, length);
+    CHECK_EQUAL(4096, atTarget.length);
+    CHECK(atTarget.match);
+    CHECK_EQUAL(expectedChunk, atTarget.largest);
+    CHECK_EQUAL(2048, back);
+    CHECK_EQUAL(2048, atInitiator.length);
+    CHECK(atInitiator.match);
+    CHECK_EQUAL(expectedChunk, atInitiator.largest);
+    CHECK_EQUAL(2 * (chunks(4096, expectedChunk) + chunks(2048, expectedChunk)), frames);
+    CHECK_EQUAL(0, initiatorBoard.overruns);
+    CHECK_EQUAL(0, targetBoard.overruns);
+}
+
+// a target refusing a chunk answers P2P_NAK, the initiator's send fails
+static void targetStops(void){
+    LinkedField field;
+    LinkedBoard initiatorBoard(&field), targetBoard(&field);
+    PeerToPeer initiator(&initiatorBoard), target(&targetBoard);
+
+    RECEIVED atTarget = {blob, 0, 100, 0, true};
+    boolean received = true;
+    std::thread peer([&]{
+        if (target.listen(2000))
+            received = target.receive(collect, &atTarget, 0);
+    });
+    CHECK(initiator.initiate(P2P_424, 2000));
+    CHECK(! initiator.send(blob, 1000));
+    initiator.release();
+    peer.join();
+    CHECK(! received);
+    CHECK(atTarget.match);
+    CHECK(atTarget.length < 100 + P2P_CHUNKSIZE);
+}
+
+// no target in the field, or one on a transport that can't write TgInitAsTarget
+static void noLink(void){
+    LinkedField field;
+    LinkedBoard initiatorBoard(&field), targetBoard(&field);
+    PeerToPeer initiator(&initiatorBoard), target(&targetBoard);
+
+    CHECK(! initiator.initiate(P2P_424, 50));
+    CHECK_EQUAL(P2P_ROLE_NONE, initiator.getRole());
+
+    targetBoard.limitToAvrI2C();
+    CHECK(! target.listen(50));
+    CHECK_EQUAL(0, targetBoard.commands);
+}
+
+int main(void){
+    for (uint16_t i = 0; i < sizeof(blob); i++)
+        blob[i] = rand();
+
+    transfer(P2P_106, false, P2P_CHUNKSIZE);
+    transfer(P2P_424, false, P2P_CHUNKSIZE);
+    transfer(P2P_424, true, 19);
+    targetStops();
+    noLink();
+    return report("peer_to_peer");
+}
@@ -0,0 +1,90 @@
+/**************************************************************************/
+/*!
+    @file     test_registers.cpp
+    @license  BSD
+
+    readRegisters and writeRegisters pack as many registers per frame as
+    packetbuffer and the transport take: 31 reads and 21 writes at the
+    default MIFARE_PACKBUFFSIZE, 11 and 7 over I2C with the AVR Wire
+    buffer. A 6 register tuning profile is one frame each way and reads
+    back intact.
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+#include "test.h"
+
+EmulatedBoard emulated;
+PN532 * board = &emulated;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+Mifare mifare;
+
+static int frames(int count, int batch){
+    return (count + batch - 1) / batch;
+}
+
+/*
+ 64 registers written and read back, in frames of writeBatch and
+ readBatch registers
+ */
+static void batches(int writeBatch, int readBatch){
+    MIFARE_REGISTER registers[64];
+    for (uint8_t i = 0; i < 64; i++) {
+        registers[i].address = PN532_REG_CIU_MODE + i;
+        registers[i].value = i * 3;
+    }
+
+    emulated.registers.clear();
+    emulated.clearCounters();
+    CHECK(mifare.writeRegisters(registers, 64));
+    CHECK_EQUAL(frames(64, writeBatch), emulated.registerFrames);
+    for (uint8_t i = 0; i < 64; i++)
+        CHECK_EQUAL(i * 3, emulated.registers[PN532_REG_CIU_MODE + i]);
+
+    for (uint8_t i = 0; i < 64; i++)
+        registers[i].value = 0;
+    emulated.clearCounters();
+    CHECK(mifare.readRegisters(registers, 64));
+    CHECK_EQUAL(frames(64, readBatch), emulated.registerFrames);
+    for (uint8_t i = 0; i < 64; i++)
+        CHECK_EQUAL(i * 3, registers[i].value);
+    CHECK_EQUAL(0, emulated.overruns);
+}
+
+// a high gain profile: receiver gain, driver conductance, thresholds
+static void profile(void){
+    static const MIFARE_REGISTER highGain[6] = {
+        {PN532_REG_CIU_RFCFG, 0x7A}, {PN532_REG_CIU_GSNON, 0xFF}, {PN532_REG_CIU_CWGSP, 0x3F},
+        {PN532_REG_CIU_MODGSP, 0x3F}, {PN532_REG_CIU_RXTHRESHOLD, 0x55}, {PN532_REG_CIU_DEMOD, 0x4D}};
+    MIFARE_REGISTER readBack[6];
+
+    emulated.registers.clear();
+    emulated.clearCounters();
+    CHECK(mifare.writeRegisters(highGain, 6));
+    for (uint8_t i = 0; i < 6; i++)
+        readBack[i].address = highGain[i].address;
+    CHECK(mifare.readRegisters(readBack, 6));
+    CHECK_EQUAL(2, emulated.registerFrames);
+    for (uint8_t i = 0; i < 6; i++)
+        CHECK_EQUAL(highGain[i].value, readBack[i].value);
+}
+
+int main(void){
+    // a ReadRegister takes 2 bytes a register, its response 9 + 1; a WriteRegister 3
+    int readBatch = MIFARE_REGISTERS_READ;
+    if (readBatch > (emulated.commandLimit - 1) / 2)
+        readBatch = (emulated.commandLimit - 1) / 2;
+    batches(MIFARE_REGISTERS_WRITE, readBatch);
+    profile();
+
+    emulated.limitToAvrI2C();
+    batches(7, 11);
+    profile();
+    return report("registers");
+}
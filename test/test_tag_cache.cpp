@@ -0,0 +1,151 @@
+/**************************************************************************/
+/*!
+    @file     test_tag_cache.cpp
+    @license  BSD
+
+    TagCache serves a tag presented again from memory after checking its
+    fingerprint: an authentication and a READ on a classic card, one READ
+    on an ultralight. A changed message is read again, and the least
+    recently used entry makes room for a new tag.
+
+*/
+/**************************************************************************/
+
+#include "emulator.h"
+#include "TagCache.h"
+#include "test.h"
+
+EmulatedBoard emulated;
+PN532 * board = &emulated;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+static const uint8_t factoryKey[6] = MIFARE_KEY_DEFAULT;
+
+Mifare mifare;
+TagCache cache;
+uint8_t buffer[300];
+
+// what the last readMessage cost
+int exchanges, authentications, reads;
+
+// writes a URI to tag, then takes it out of the field
+static void writeURI(EmulatedTag * tag, const char * uri){
+    uint8_t message[100];
+    strcpy((char *)message, uri);
+    uint16_t length = NDEF().encode_URI(NDEF_URIPREFIX_NONE, message);
+
+    tag->halted = false;
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(mifare.writePayload(session, message, length));
+    mifare.release(session);
+}
+
+/*
+ tag comes into the field alone with a new session, as when it is
+ presented again, and its message is read through the cache
+ */
+static boolean present(EmulatedTag * tag, FOUND_MESSAGE * message){
+    tag->halted = false;
+    emulated.tags.assign(1, tag);
+    MIFARE_SESSION * session = mifare.detect();
+    CHECK(session != 0);
+
+    emulated.clearCounters();
+    boolean success = cache.readMessage(mifare, session, buffer, sizeof(buffer), message);
+    exchanges = emulated.exchanges;
+    authentications = emulated.authentications;
+    reads = emulated.reads;
+    mifare.release(session);
+    return success;
+}
+
+static boolean payloadIs(FOUND_MESSAGE * message, const char * uri){
+    return message->length == strlen(uri) && memcmp(message->payload, uri, message->length) == 0;
+}
+
+static void classicHit(void){
+    EmulatedTag * tag = classicTag(MIFARE_CLASSIC, 0x10, factoryKey, factoryKey);
+    FOUND_MESSAGE message;
+    writeURI(tag, "example.com/classic");
+
+    cache.clear();
+    cache.hits = cache.misses = 0;
+    CHECK(present(tag, &message));
+    CHECK_EQUAL(1, cache.misses);
+    CHECK(payloadIs(&message, "example.com/classic"));
+
+    // the block kept in the entry spares the MAD
+    CHECK(present(tag, &message));
+    CHECK_EQUAL(1, cache.hits);
+    CHECK(payloadIs(&message, "example.com/classic"));
+    CHECK_EQUAL(1, authentications);
+    CHECK_EQUAL(1, reads);
+    CHECK_EQUAL(2, exchanges);
+
+    // a new message changes the fingerprint
+    writeURI(tag, "example.org/changed");
+    CHECK(present(tag, &message));
+    CHECK_EQUAL(2, cache.misses);
+    CHECK(payloadIs(&message, "example.org/changed"));
+    delete tag;
+}
+
+static void ultralightHit(void){
+    EmulatedTag * tag = ntagTag(45, 0x20);
+    FOUND_MESSAGE message;
+    writeURI(tag, "example.com/ntag");
+
+    cache.clear();
+    cache.hits = cache.misses = 0;
+    CHECK(present(tag, &message));
+    CHECK(present(tag, &message));
+    CHECK_EQUAL(1, cache.hits);
+    CHECK(payloadIs(&message, "example.com/ntag"));
+    CHECK_EQUAL(1, reads);
+    CHECK_EQUAL(1, exchanges);
+    delete tag;
+}
+
+// TAGCACHE_ENTRIES tags fill the cache, one more evicts the least recently used
+static void eviction(void){
+    EmulatedTag * tags[TAGCACHE_ENTRIES + 1];
+    FOUND_MESSAGE message;
+    char uri[32];
+
+    cache.clear();
+    for (uint8_t i = 0; i <= TAGCACHE_ENTRIES; i++) {
+        tags[i] = ultralightTag(16, 0x30 + i * 8);
+        sprintf(uri, "example.com/%d", i);
+        writeURI(tags[i], uri);
+    }
+
+    cache.hits = cache.misses = 0;
+    for (uint8_t i = 0; i < TAGCACHE_ENTRIES; i++)
+        present(tags[i], &message);
+    // tag 0 is used again, tag 1 is now the oldest
+    present(tags[0], &message);
+    present(tags[TAGCACHE_ENTRIES], &message);
+    CHECK_EQUAL(TAGCACHE_ENTRIES + 1, cache.misses);
+    CHECK_EQUAL(1, cache.hits);
+
+    present(tags[0], &message);
+    CHECK_EQUAL(2, cache.hits);
+    present(tags[1], &message);
+    CHECK_EQUAL(TAGCACHE_ENTRIES + 2, cache.misses);
+    CHECK(payloadIs(&message, "example.com/1"));
+
+    for (uint8_t i = 0; i <= TAGCACHE_ENTRIES; i++)
+        delete tags[i];
+}
+
+int main(void){
+    classicHit();
+    ultralightHit();
+    eviction();
+    return report("tag_cache");
+}
@@ -0,0 +1,106 @@
+/**************************************************************************/
+/*!
+    @file     test_tag_emulator.cpp
+    @license  BSD
+
+    A TagEmulator is read by Mifare's type 4 reader over two linked
+    PN532s: the message arrives whole, the application's image untouched,
+    in as few READ BINARY as the smaller of the reader's frame and the
+    emulator's MLe allow. 1400 bytes of MIME take 32 APDUs at the default
+    buffer sizes. A reader on I2C with the AVR Wire buffer reads in
+    18 byte pieces, an emulator there fails up front.
+
+*/
+/**************************************************************************/
+
+#include "link.h"
+#include "TagEmulator.h"
+#include "Mifare.h"
+#include "NDEF.h"
+#include "test.h"
+#include <thread>
+
+PN532 * board = 0;
+
+uint8_t Mifare::useKey = KEY_B;
+uint8_t Mifare::keyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+uint8_t Mifare::keyB[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint32_t Mifare::cardType = 0;
+
+// NLEN of the message in a TLV image from NDEF::encode_*
+static uint16_t messageLength(const uint8_t * image){
+    return (image[1] == 0xFF) ? (image[2] << 8) | image[3] : image[1];
+}
+
+/*
+ the reader reads a MIME record of size bytes: SELECT of the application,
+ SELECT and READ BINARY of the CC, SELECT of the NDEF file, then NLEN and
+ the message le bytes at a time
+ */
+static void readEmulated(uint16_t size, boolean readerOnI2C, uint8_t le){
+    static uint8_t data[1400], image[1500], before[1500], output[1500];
+    for (uint16_t i = 0; i < size; i++)
+        data[i] = rand();
+    memcpy(image, data, size);
+    uint16_t length = NDEF().encode_MIME((uint8_t *)"application/octet-stream", image, size);
+    memcpy(before, image, length);
+
+    LinkedField field;
+    LinkedBoard readerBoard(&field), phoneBoard(&field);
+    if (readerOnI2C)
+        readerBoard.limitToAvrI2C();
+    board = &readerBoard;
+    TagEmulator emulator(&phoneBoard);
+    CHECK(emulator.begin());
+    CHECK(emulator.setMessage(image, length));
+
+    boolean served = false;
+    std::thread phone([&]{ served = emulator.emulate(2000); });
+    Mifare mifare;
+    MIFARE_SESSION * session = mifare.detect(2000);
+    CHECK(session != 0);
+    if (session) {
+        CHECK(session->target.sak & MIFARE_SAK_ISODEP);
+        CHECK(mifare.readPayload(session, output, sizeof(output)));
+        mifare.release(session);
+    }
+    phone.join();
+
+    CHECK(served);
+    CHECK_EQUAL(4 + (messageLength(image) + 2 + le - 1) / le, emulator.apduCount);
+    FOUND_MESSAGE message = NDEF().decode_message(output);
+    CHECK_EQUAL(size, message.length);
+    CHECK(message.payload && memcmp(message.payload, data, size) == 0);
+    CHECK(memcmp(before, image, length) == 0);
+    CHECK_EQUAL(0, readerBoard.overruns);
+    CHECK_EQUAL(0, phoneBoard.overruns);
+}
+
+// TgInitAsTarget doesn't fit the AVR Wire buffer, emulate sends nothing
+static void emulatorOnI2C(void){
+    uint8_t image[64];
+    strcpy((char *)image, "example.com");
+    uint16_t length = NDEF().encode_URI(NDEF_URIPREFIX_NONE, image);
+
+    LinkedField field;
+    LinkedBoard phoneBoard(&field);
+    phoneBoard.limitToAvrI2C();
+    TagEmulator emulator(&phoneBoard);
+    CHECK(emulator.setMessage(image, length));
+    phoneBoard.commands = 0;
+    CHECK(! emulator.emulate(50));
+    CHECK_EQUAL(0, phoneBoard.commands);
+}
+
+int main(void){
+    // a response frame takes 12 bytes besides the data
+    uint8_t le = (MIFARE_PACKBUFFSIZE - 12 < EMULATOR_MLE) ? MIFARE_PACKBUFFSIZE - 12 : EMULATOR_MLE;
+
+    readEmulated(10, false, le);
+    readEmulated(200, false, le);
+    readEmulated(600, false, le);
+    readEmulated(1400, false, le);
+    readEmulated(600, true, 30 - 12);
+    emulatorOnI2C();
+    return report("tag_emulator");
+}